@@ -2,10 +2,13 @@
 #define NIE_LOG_HPP
 
 #include "function_ref.hpp"
+#include "log_format.hpp"
 #include "require.hpp"
 #include "startup.hpp"
 #include "string_literal.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cstring>
@@ -13,11 +16,19 @@
 #include <iostream>
 #include <nie.hpp>
 #include <print>
+#include <ranges>
 #include <source_location>
 #include <span>
 #include <sstream>
+#include <tuple>
 
+#if defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 #ifndef _WIN32
+#include <time.h>
 extern "C" {
 extern char __executable_start[];
 }
@@ -49,17 +60,161 @@ namespace spinemarrow {
   using node_handle = std::shared_ptr<node_handle_data>;
 } // namespace spinemarrow
 namespace nie {
-  char* log_frame(uint32_t size, uint32_t index, std::chrono::tai_clock::time_point time);
+  // Source of frame timestamps, picked and calibrated by init_log (see log.clock) and recorded in every log file header.
+  extern nie::log_clock_t log_clock;
+  inline uint64_t log_clock_now() {
+    switch (log_clock.kind) {
+#if defined(__x86_64__) || defined(_M_X64)
+    case nie::log_clock_e::tsc:
+      return __rdtsc();
+#endif
+#if defined(__linux__)
+    case nie::log_clock_e::monotonic_coarse: {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+      return (uint64_t(ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+    }
+#endif
+    default:
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::tai_clock::now().time_since_epoch()).count();
+    }
+  }
+  inline std::chrono::tai_clock::time_point log_clock_time(uint64_t ticks) {
+    return std::chrono::tai_clock::time_point(std::chrono::microseconds(log_clock.tai(ticks)));
+  }
+
+  char* log_frame(uint32_t size, uint32_t index, uint64_t time);
+  // Reserves up to count frames like log_frame, back to back in the thread's chunk, and sets count to how many it got.
+  // Returns the payload of the first; each next one starts size + sizeof(log_frame_t) bytes further on.
+  char* log_frames(uint32_t size, uint32_t index, uint64_t time, size_t& count);
+  // Set while a collector is attached to the live tap, see log.tap.
+  extern std::atomic<bool> log_tap_attached;
+  void log_tap_push(const log_frame_t*);
+  // Marks the frame log_frame returned as complete; frames a crash interrupted are never committed and readers skip them.
+  inline void log_commit(char* data) {
+    auto frame = reinterpret_cast<log_frame_t*>(data - sizeof(log_frame_t));
+    frame->size.store(frame->size.load(std::memory_order_relaxed) | log_frame_committed, std::memory_order_release);
+    if (log_tap_attached.load(std::memory_order_relaxed)) [[unlikely]]
+      log_tap_push(frame);
+  }
+  // Spreads a payload of log_variable_size bytes or more over a head frame and continuation frames as it is written, see
+  // log_frame_continued. If a continuation frame cannot be had the head is turned into padding and nothing is logged.
+  struct log_split_writer {
+    char* head = nullptr;
+    char* current = nullptr;
+    char* ptr = nullptr;
+    size_t leftover = 0;
+    size_t remaining = 0;
+    uint64_t time = 0;
+    uint64_t key = 0;
+    bool failed = false;
+    // Whether this split, rather than one it is nested in, keeps the thread's frames in the head's segment.
+    bool held = false;
+
+    // Takes len rounded up to 8, returns the head frame or nullptr.
+    char* begin(size_t len, uint32_t index, uint64_t time);
+    bool next();
+    // Zeroes the rest of the last frame and commits; returns the head frame unless a continuation was lost.
+    char* finish();
+    inline void write(void const* d, size_t len) {
+      auto src = static_cast<const char*>(d);
+      while (len) {
+        if (!leftover && !next())
+          return;
+        size_t n = std::min(len, leftover);
+        std::memcpy(ptr, src, n);
+        ptr += n;
+        src += n;
+        len -= n;
+        leftover -= n;
+      }
+    }
+  };
+  // Writes the mapped log back to disk; called on the way down from nie::fatal.
+  void log_sync();
   void write_log_file(std::string_view);
-  void add_log_disabler(std::string_view, bool*);
+  // Text echo is queued and rendered on a background thread; log_text_flush waits until everything queued so far is out.
+  void log_text(std::string_view descriptor, uint64_t time, const void* frame, std::span<const char> payload);
+  void log_text(std::string line);
+  void log_text_flush();
+  char* log_scratch();
+
+  struct log_limit_t {
+    // Keeps one event in sample_every, per thread.
+    uint32_t sample_every = 1;
+    // Token bucket shared by all threads; a rate of 0 means unlimited.
+    double per_second = 0;
+    uint32_t burst = 0;
+  };
+  // Per-message throttle state. Suppressed events are counted in a thread_local first and folded in once the thread logs
+  // again or has a few thousand pending, so the summary the log worker writes lags a little behind.
+  struct log_limiter_t {
+    std::atomic<bool> active = false;
+    std::atomic<uint32_t> sample_every = 1;
+    std::atomic<uint64_t> interval = 0;
+    std::atomic<uint64_t> tolerance = 0;
+    std::atomic<uint64_t> tat = 0;
+    std::atomic<uint64_t> suppressed = 0;
+    std::string_view name;
+
+    bool admit_rate();
+    inline bool suppress(uint64_t& pending) {
+      if (++pending >= 4096) {
+        suppressed.fetch_add(pending, std::memory_order_relaxed);
+        pending = 0;
+      }
+      return false;
+    }
+    inline bool admit(uint32_t& sampled, uint64_t& pending) {
+      auto every = sample_every.load(std::memory_order_relaxed);
+      if ((every > 1) && (++sampled < every))
+        return suppress(pending);
+      sampled = 0;
+      if (interval.load(std::memory_order_relaxed) && !admit_rate())
+        return suppress(pending);
+      if (pending) {
+        suppressed.fetch_add(pending, std::memory_order_relaxed);
+        pending = 0;
+      }
+      return true;
+    }
+  };
+
+  void add_log_disabler(std::string_view, std::atomic<bool>*, log_limiter_t*);
+  // Turns every message whose dotted name is, or starts with, prefix on or off at runtime; "*" matches all messages.
+  // Warnings, errors and fatals are always logged.
+  void set_log_enabled(std::string_view prefix, bool enabled);
+  // Samples and rate limits messages by prefix the same way; the most specific prefix applies.
+  void set_log_limit(std::string_view prefix, const log_limit_t& limit);
   void init_log();
+  // Bumped whenever the log moves to a new segment, so descriptors and registrations are written again.
+  extern std::atomic<uint32_t> log_generation;
+  // Number of the segment the thread's chunk is in, so of the frame it reserved last.
+  inline thread_local uint32_t log_chunk_segment = 0;
+  // Writes a descriptor into the segment of the thread's chunk, which must still hold a frame that is not committed.
+  bool log_describe(std::string_view text, uint32_t index);
 
   struct log_cookie {
     void* ptr = nullptr;
   };
   template <typename T, typename Enabler = void> struct log_info;
+  // A type can describe itself as a tuple of already loggable fields instead of being formatted, either with a member
+  //   auto log_fields() const { return std::tuple("x"_log = x, "y"_log = y); }
+  // or by specializing log_fields_of<T> with a static get(const T&). The log_params refer to their values, so those must
+  // outlive the call (members, not temporaries). Fields are written in place as <name>.<field>, records nest.
+  template <typename T> struct log_fields_of;
+  template <typename T>
+    requires requires(const T& v) { v.log_fields(); }
+  struct log_fields_of<T> {
+    inline static auto get(const T& v) {
+      return v.log_fields();
+    }
+  };
+  template <typename T> concept log_record = requires(const T& v) { log_fields_of<T>::get(v); };
   template <typename T> struct fallback_formatter;
-  template <std::formattable<char> T> struct fallback_formatter<T> {
+  template <std::formattable<char> T>
+    requires(!log_record<T>)
+  struct fallback_formatter<T> {
     using valid = void;
     static std::string format(const T& v) {
       return std::format("{}", v);
@@ -69,11 +224,19 @@ namespace nie {
     static constexpr auto name = "invalid"_lit;
     static constexpr size_t size = 65536;
 
-    inline static void write(auto& logger, const log_param<a, T>& v) {
-      auto str = fallback_formatter<T>::format(v.value);
+    inline static std::string prepare(const log_param<a, T>& v) {
+      return fallback_formatter<T>::format(v.value);
+    }
+    inline static size_t length(const std::string& str) {
+      return sizeof(uint32_t) + str.size();
+    }
+    inline static void write(auto& logger, const std::string& str) {
       logger.template write_int<uint32_t>(str.size());
       logger.write(str.data(), str.size());
     }
+    inline static void write(auto& logger, const log_param<a, T>& v) {
+      write(logger, prepare(v));
+    }
     inline static void format(std::stringstream& ss, const log_param<a, T>& v) {
       ss << fallback_formatter<T>::format(v.value);
     }
@@ -82,11 +245,19 @@ namespace nie {
     static constexpr auto name = "string"_lit;
     static constexpr size_t size = 65536;
 
-    inline static void write(auto& logger, const log_param<a, char*>& v) {
-      auto str = v.value ? std::format("{}", v.value) : std::string("null");
+    inline static std::string_view prepare(const log_param<a, char*>& v) {
+      return v.value ? std::string_view(v.value) : std::string_view("null");
+    }
+    inline static size_t length(std::string_view str) {
+      return sizeof(uint32_t) + str.size();
+    }
+    inline static void write(auto& logger, std::string_view str) {
       logger.template write_int<uint32_t>(str.size());
       logger.write(str.data(), str.size());
     }
+    inline static void write(auto& logger, const log_param<a, char*>& v) {
+      write(logger, prepare(v));
+    }
     inline static void format(std::stringstream& ss, const log_param<a, char*>& v) {
       if (v.value)
         ss << std::format("'{}'", v.value);
@@ -98,11 +269,19 @@ namespace nie {
     static constexpr auto name = "string"_lit;
     static constexpr size_t size = 65536;
 
-    inline static void write(auto& logger, const log_param<a, const char*>& v) {
-      auto str = v.value ? std::format("{}", v.value) : std::string("null");
+    inline static std::string_view prepare(const log_param<a, const char*>& v) {
+      return v.value ? std::string_view(v.value) : std::string_view("null");
+    }
+    inline static size_t length(std::string_view str) {
+      return sizeof(uint32_t) + str.size();
+    }
+    inline static void write(auto& logger, std::string_view str) {
       logger.template write_int<uint32_t>(str.size());
       logger.write(str.data(), str.size());
     }
+    inline static void write(auto& logger, const log_param<a, const char*>& v) {
+      write(logger, prepare(v));
+    }
     inline static void format(std::stringstream& ss, const log_param<a, const char*>& v) {
       if (v.value)
         ss << std::format("'{}'", v.value);
@@ -114,6 +293,9 @@ namespace nie {
     static constexpr auto name = "string"_lit;
     static constexpr size_t size = 65536;
 
+    inline static size_t length(const log_param<a, std::string_view>& v) {
+      return sizeof(uint32_t) + v.value.size();
+    }
     inline static void write(auto& logger, const log_param<a, std::string_view>& v) {
       logger.template write_int<uint32_t>(v.value.size());
       logger.write(v.value.data(), v.value.size());
@@ -126,6 +308,9 @@ namespace nie {
     static constexpr auto name = "binary"_lit;
     static constexpr size_t size = 65536;
 
+    inline static size_t length(const log_param<a, std::span<const uint8_t>>& v) {
+      return sizeof(uint32_t) + v.value.size();
+    }
     inline static void write(auto& logger, const log_param<a, std::span<const uint8_t>>& v) {
       logger.template write_int<uint32_t>(v.value.size());
       logger.write(v.value.data(), v.value.size());
@@ -138,6 +323,9 @@ namespace nie {
     static constexpr auto name = "string"_lit;
     static constexpr size_t size = 65536;
 
+    inline static size_t length(const log_param<a, std::string>& v) {
+      return sizeof(uint32_t) + v.value.size();
+    }
     inline static void write(auto& logger, const log_param<a, std::string>& v) {
       logger.template write_int<uint32_t>(v.value.size());
       logger.write(v.value.data(), v.value.size());
@@ -153,7 +341,10 @@ namespace nie {
     static constexpr size_t size = 8;
 
     inline static void write(auto& logger, const log_param<a, nie::string>& v) {
-      register_nie_string(v.value);
+      auto data = static_cast<nie::string_data const*>(v.value.ptr());
+      if (data && (data->logged_generation.load(std::memory_order_relaxed) != log_generation.load(std::memory_order_relaxed)))
+          [[unlikely]]
+        register_nie_string(v.value);
       logger.template write_int<uint64_t>(size_t(v.value.ptr()));
     }
     inline static void format(std::stringstream& ss, const log_param<a, nie::string>& v) {
@@ -260,7 +451,7 @@ namespace nie {
     }
   };
   template <nie::string_literal a, typename T> struct log_info<log_param<a, T*>> {
-    static constexpr auto name = "uint64"_lit;
+    static constexpr auto name = "pointer"_lit;
     static constexpr size_t size = 8;
 
     inline static void write(auto& logger, const log_param<a, T*>& v) {
@@ -271,7 +462,7 @@ namespace nie {
     }
   };
   template <nie::string_literal a, typename T> struct log_info<log_param<a, T>, std::enable_if_t<vk::isVulkanHandleType<T>::value>> {
-    static constexpr auto name = "uint64"_lit;
+    static constexpr auto name = "pointer"_lit;
     static constexpr size_t size = 8;
 
     inline static void write(auto& logger, const log_param<a, T>& v) {
@@ -310,6 +501,7 @@ namespace nie {
   template <nie::string_literal a> struct log_info<log_param<a, spinemarrow::node_handle>> {
     static constexpr auto name = "node_handle"_lit;
     static constexpr size_t size = 8;
+    static constexpr bool sync_text = true;
 
     inline static void write(auto& logger, const log_param<a, spinemarrow::node_handle>& v);
     inline static void format(std::stringstream& ss, const log_param<a, spinemarrow::node_handle>& v) {
@@ -319,12 +511,23 @@ namespace nie {
         ss << "(nil)";
     }
   };
+  // Arguments whose text form cannot be recovered from their binary form are formatted on the calling thread.
+  template <typename T> inline constexpr bool log_sync_text = requires { requires log_info<T>::sync_text; };
   template <typename T> struct log_name;
   template <nie::string_literal a, typename T> struct log_name<log_param<a, T>> {
     static constexpr nie::string_literal name = a;
     static constexpr nie::string_literal type =
         string_literal_cat<":A:", log_info<log_param<a, T>>::name, ":", to_string<a.n() - 1>, ":", a>;
   };
+  template <nie::string_literal a, typename Fields> struct log_record_type;
+  template <nie::string_literal a, nie::string_literal... b, typename... T> struct log_record_type<a, std::tuple<log_param<b, T>...>> {
+    static_assert(sizeof...(T) > 0, "a log record needs at least one field");
+    static constexpr nie::string_literal value = string_literal_cat<"", log_name<log_param<string_literal_cat<a, ".", b>, T>>::type...>;
+  };
+  template <nie::string_literal a, log_record T> struct log_name<log_param<a, T>> {
+    static constexpr nie::string_literal name = a;
+    static constexpr nie::string_literal type = log_record_type<a, decltype(log_fields_of<T>::get(std::declval<const T&>()))>::value;
+  };
   template <typename T> struct simple_logger : T {
     void* frame;
     template <typename V> void write_int(V v) {
@@ -332,9 +535,99 @@ namespace nie {
     }
   };
 
+  // log_info<T>::size of 65536 or more marks a variable-size argument. Those may provide prepare(), whose result is sized
+  // and written instead of the argument so nothing is formatted twice, and/or length() to size without a dry run.
+  inline constexpr size_t log_variable_size = 65536;
+  template <typename T> inline decltype(auto) log_prepare(const T& v) {
+    if constexpr (requires { log_info<T>::prepare(v); })
+      return log_info<T>::prepare(v);
+    else
+      return (v);
+  }
+  // What log_prepare(T) yields, held by value; arguments without prepare() are their own log_param.
+  template <typename T> using log_prepared_t = std::decay_t<decltype(log_prepare(std::declval<const T&>()))>;
+  struct log_length_counter {
+    size_t length = 0;
+    inline void write(void const* ptr, size_t len) {
+      length += len;
+    }
+  };
+  template <typename T, typename P> inline size_t log_length(const P& p) {
+    if constexpr (log_info<T>::size < log_variable_size)
+      return log_info<T>::size;
+    else if constexpr (requires { log_info<T>::length(p); })
+      return log_info<T>::length(p);
+    else {
+      simple_logger<log_length_counter> ll;
+      ll.frame = nullptr;
+      log_info<T>::write(ll, p);
+      return ll.length;
+    }
+  }
+
+  // The payload of a record is the payloads of its fields back to back, so the descriptor's flattened fields decode it.
+  template <nie::string_literal a, log_record T> struct log_info<log_param<a, T>> {
+    using fields = decltype(log_fields_of<T>::get(std::declval<const T&>()));
+    template <typename F> struct traits;
+    template <typename... F> struct traits<std::tuple<F...>> {
+      static constexpr bool fixed_size = ((log_info<F>::size < log_variable_size) && ...);
+      static constexpr size_t size = fixed_size ? (log_info<F>::size + ... + 0) : log_variable_size;
+      static constexpr bool sync_text = (log_sync_text<F> || ...);
+      // Each field prepared once, for both sizing and writing.
+      using prepared = std::tuple<log_prepared_t<F>...>;
+      inline static prepared prepare(const fields& f) {
+        return std::apply([](const auto&... p) { return prepared{log_prepare(p)...}; }, f);
+      }
+      inline static size_t length(const prepared& p) {
+        return std::apply([](const auto&... q) { return (log_length<F>(q) + ... + 0); }, p);
+      }
+      inline static void write(auto& logger, const prepared& p) {
+        std::apply([&](const auto&... q) { (log_info<F>::write(logger, q), ...); }, p);
+      }
+    };
+    using prepared = typename traits<fields>::prepared;
+    static constexpr size_t size = traits<fields>::size;
+    static constexpr bool sync_text = traits<fields>::sync_text;
+
+    inline static prepared prepare(const log_param<a, T>& v) {
+      return traits<fields>::prepare(log_fields_of<T>::get(v.value));
+    }
+    inline static size_t length(const prepared& p) {
+      return traits<fields>::length(p);
+    }
+    inline static void write(auto& logger, const prepared& p) {
+      traits<fields>::write(logger, p);
+    }
+    inline static void write(auto& logger, const log_param<a, T>& v) {
+      write(logger, prepare(v));
+    }
+    inline static void format(std::stringstream& ss, const log_param<a, T>& v) {
+      bool first = true;
+      ss << "{";
+      std::apply(
+          [&](const auto&... p) {
+            auto m = [&]<typename F>(const F& field) {
+              ss << (first ? "" : ", ") << log_name<F>::name() << " = ";
+              first = false;
+              log_info<F>::format(ss, field);
+            };
+            (m(p), ...);
+          },
+          log_fields_of<T>::get(v.value));
+      ss << "}";
+    }
+  };
+
   using namespace std::literals;
 
   enum class level_e { fatal, error, warn, info, debug, trace, internal };
+#ifndef NIE_LOG_LEVEL
+#define NIE_LOG_LEVEL internal
+#endif
+  // Messages more verbose than this are compiled out, including their descriptors and registrations. Use NIE_LOG to skip
+  // evaluating the arguments as well.
+  inline constexpr level_e log_level_compiled = level_e::NIE_LOG_LEVEL;
+  template <level_e level> inline constexpr bool log_level_enabled = (level <= log_level_compiled);
   inline std::string_view levstr(level_e l) {
     switch (l) {
       using enum level_e;
@@ -357,49 +650,156 @@ namespace nie {
   }
   template <string_literal message> struct log_message {
     static constexpr bool cookie = true;
-    inline static bool has_info = false;
+    // The segment number and log generation the descriptor was last written under, see logger::describe_frame.
+    inline static std::atomic<uint64_t> info_generation = 0;
   };
   template <string_literal message> struct log_message_disable {
-    inline static bool is_disabled = false;
-    inline static volatile bool init_cookie = nie::register_startup([] { add_log_disabler(message(), &is_disabled); });
+    inline static std::atomic<bool> is_disabled = false;
+    inline static log_limiter_t limiter;
+    inline static thread_local uint32_t sampled = 0;
+    inline static thread_local uint64_t pending = 0;
+    inline static volatile bool init_cookie = nie::register_startup([] { add_log_disabler(message(), &is_disabled, &limiter); });
   };
 
   template <string_literal... area> struct logger {
     template <string_literal message, typename... T> inline log_cookie internal(const T&... args) {
-      return do_log<level_e::internal, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::internal>)
+        return do_log<level_e::internal, message, T...>(args...);
+      else
+        return {};
     }
     template <string_literal message, typename... T> inline log_cookie trace(const T&... args) {
-      return do_log<level_e::trace, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::trace>)
+        return do_log<level_e::trace, message, T...>(args...);
+      else
+        return {};
     }
     template <string_literal message, typename... T> inline log_cookie debug(const T&... args) {
-      return do_log<level_e::debug, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::debug>)
+        return do_log<level_e::debug, message, T...>(args...);
+      else
+        return {};
     }
     template <string_literal message, typename... T> inline log_cookie info(const T&... args) {
-      return do_log<level_e::info, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::info>)
+        return do_log<level_e::info, message, T...>(args...);
+      else
+        return {};
     }
     template <string_literal message, typename... T> inline log_cookie warn(const T&... args) {
-      return do_log<level_e::warn, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::warn>)
+        return do_log<level_e::warn, message, T...>(args...);
+      else
+        return {};
     }
     template <string_literal message, typename... T> inline log_cookie error(const T&... args) {
-      return do_log<level_e::error, message, T...>(args...);
+      if constexpr (log_level_enabled<level_e::error>)
+        return do_log<level_e::error, message, T...>(args...);
+      else
+        return {};
+    }
+    // Registrations of the strings, source locations and capnp schemas that other frames refer to by id. They are written
+    // whatever the compiled or runtime level, since frames that are logged would otherwise not resolve.
+    template <string_literal message, typename... T> inline log_cookie registration(const T&... args) {
+      auto now = log_clock_now();
+      return emit<level_e::info, message, T...>(now, describe<level_e::info, message, T...>(), nullptr, args...);
     }
     template <string_literal message, typename... T> [[noreturn]] inline void fatal(const T&... args) {
       do_log<level_e::fatal, message, T...>(args...);
       nie::fatal("fatal failed");
     }
+    // Logs an event per element of range, taking its arguments from fields(element) as a tuple of log_params that refer to
+    // the element. The events share one clock read, and when their arguments are of fixed size their frames are reserved
+    // back to back, as many at a time as the thread's chunk holds, with one descriptor check per reservation. Returns the
+    // events logged.
+    template <level_e level, string_literal message, std::ranges::input_range R, typename F> inline size_t batch(R&& range, F&& fields) {
+      static_assert(level != level_e::fatal);
+      if constexpr (log_level_enabled<level>)
+        return do_batch<level, message>(range, fields, std::type_identity<decltype(fields(*std::ranges::begin(range)))>{});
+      else
+        return 0;
+    }
 
   private:
+    template <level_e level, string_literal message, typename R, typename F, typename... Args>
+    inline size_t do_batch(R& range, F& fields, std::type_identity<std::tuple<Args...>>) {
+      constexpr auto msg_data = dotted<area..., message>;
+      using limit = log_message_disable<msg_data>;
+      if constexpr ((level != level_e::warn) && (level != level_e::error)) {
+        static_cast<void>(&limit::init_cookie);
+        if (limit::is_disabled.load(std::memory_order_relaxed)) [[unlikely]]
+          return 0;
+      }
+      auto now = log_clock_now();
+      auto index = describe<level, message, Args...>();
+      constexpr bool fixed_size = ((log_info<Args>::size < log_variable_size) && ...);
+      constexpr size_t len = (((log_info<Args>::size + ... + 0) + 7ULL) & ~7ULL);
+      char* frame = nullptr;
+      size_t reserved = 0;
+      size_t logged = 0;
+      // Read once, so that a limit switched on partway through cannot strand frames reserved for the rest of the batch.
+      bool limited = false;
+      if constexpr ((level != level_e::warn) && (level != level_e::error))
+        limited = limit::limiter.active.load(std::memory_order_relaxed);
+      auto end = std::ranges::end(range);
+      for (auto it = std::ranges::begin(range); it != end; ++it) {
+        if (limited && !limit::limiter.admit(limit::sampled, limit::pending)) [[unlikely]]
+          continue;
+        char* slot = nullptr;
+        // Sampled events are reserved one at a time, so no reserved frame is left unused.
+        if constexpr (fixed_size)
+          if (!limited) {
+            if (!reserved) {
+              if constexpr (std::ranges::forward_range<R>)
+                reserved = std::ranges::distance(it, end);
+              else
+                reserved = 1;
+              frame = log_frames(len, index, now, reserved);
+              // A reservation after a rollover is in a segment that has not seen the descriptor yet.
+              if (frame)
+                describe_frame<level, message, Args...>(index);
+            }
+            if (frame) {
+              slot = frame;
+              frame += len + sizeof(log_frame_t);
+              reserved--;
+            }
+          }
+        auto cookie =
+            std::apply([&](const auto&... args) { return emit<level, message, Args...>(now, index, slot, args...); }, fields(*it));
+        logged += (cookie.ptr != nullptr);
+      }
+      return logged;
+    }
+
     template <level_e level, string_literal message, typename... Args> inline log_cookie do_log(const Args&... args) {
-      auto now = std::chrono::tai_clock::now();
       constexpr auto msg_data = dotted<area..., message>;
-      constexpr auto text = string_literal_cat<"0:",
-          to_string<static_cast<size_t>(level)>,
-          ":",
-          to_string<msg_data.n() - 1>,
-          ":",
-          msg_data,
-          log_name<Args>::type...,
-          "::">;
+      if constexpr ((level != level_e::warn) && (level != level_e::error) && (level != level_e::fatal)) {
+        static_cast<void>(&log_message_disable<msg_data>::init_cookie);
+        if (log_message_disable<msg_data>::is_disabled.load(std::memory_order_relaxed)) [[unlikely]]
+          return {nullptr};
+        using limit = log_message_disable<msg_data>;
+        if (limit::limiter.active.load(std::memory_order_relaxed)) [[unlikely]]
+          if (!limit::limiter.admit(limit::sampled, limit::pending))
+            return {nullptr};
+      }
+      auto now = log_clock_now();
+      return emit<level, message, Args...>(now, describe<level, message, Args...>(), nullptr, args...);
+    }
+
+    template <level_e level, string_literal message, typename... Args>
+    static constexpr auto descriptor_text = string_literal_cat<"0:",
+        to_string<static_cast<size_t>(level)>,
+        ":",
+        to_string<dotted<area..., message>.n() - 1>,
+        ":",
+        dotted<area..., message>,
+        log_name<Args>::type...,
+        "::">;
+
+    // The index frames refer to the message's descriptor by.
+    template <level_e level, string_literal message, typename... Args> inline static uint32_t describe() {
+      constexpr auto text = descriptor_text<level, message, Args...>;
       using msg = log_message<text>;
 #ifndef _WIN32
       assert(reinterpret_cast<const char*>(&msg::cookie) >= __executable_start);
@@ -408,69 +808,85 @@ namespace nie {
       uint32_t pos = size_t(reinterpret_cast<const char*>(&msg::cookie));
 #endif
       assert(pos <= size_t(uint32_t(-1)));
-      uint32_t index = pos;
-      if (!msg::has_info) {
-        auto d = text();
-        auto n = d.size();
-        n &= ~7ULL;
-        n += 8ULL;
-        auto frame = log_frame(n, index, {});
-        if (frame) {
-          memcpy(frame, d.data(), d.size());
-          msg::has_info = true;
-        }
-      }
+      return uint32_t(pos);
+    }
+
+    // Writes the message's descriptor into the segment of the frame just reserved, unless it went there already under this
+    // log generation. Checking after the reservation keeps a rollover from leaving the frame's segment without it.
+    template <level_e level, string_literal message, typename... Args> inline static void describe_frame(uint32_t index) {
+      using msg = log_message<descriptor_text<level, message, Args...>>;
+      uint64_t key = (uint64_t(log_chunk_segment) << 32) | log_generation.load(std::memory_order_acquire);
+      if (msg::info_generation.load(std::memory_order_relaxed) != key) [[unlikely]]
+        if (log_describe(descriptor_text<level, message, Args...>(), index))
+          msg::info_generation.store(key, std::memory_order_relaxed);
+    }
+
+    // Writes one event into reserved, a frame of the fixed size of Args, or into a frame of its own if that is null.
+    template <level_e level, string_literal message, typename... Args>
+    inline log_cookie emit(uint64_t now, uint32_t index, char* reserved, const Args&... args) {
+      constexpr auto msg_data = dotted<area..., message>;
+      std::tuple<decltype(log_prepare(args))...> prepared{log_prepare(args)...};
       auto n = [&](auto& logger) {
-        auto m = [&]<typename T>(const T& arg) { log_info<T>::write(logger, arg); };
-        (m(args), ...);
+        std::apply([&](const auto&... p) { (log_info<Args>::write(logger, p), ...); }, prepared);
       };
+      constexpr bool fixed_size = ((log_info<Args>::size < log_variable_size) && ...);
       constexpr size_t est_len = (((log_info<Args>::size + ... + 0) + 7ULL) & ~7ULL);
       size_t len = est_len;
-      /*if (est_len >= 65536) */ {
-        struct length_log {
-          size_t length = 0;
-          inline void write(void const* ptr, size_t len) {
-            length += len;
-          }
-        };
-        simple_logger<length_log> ll;
-        ll.frame = nullptr;
-        n(ll);
-        if (ll.length & 7ULL) {
-          ll.length += 7ULL;
-          ll.length &= ~7ULL;
-        }
-        // #ifndef NDEBUG
-        if (ll.length >= 65536) {
-#ifndef NDEBUG
-          std::stringstream ss;
-          bool first = true;
-          auto m = [&]<typename T>(const T& arg) {
-            if (!first)
-              ss << ", ";
-            first = false;
-            ss << log_name<T>::name() << " = ";
-            log_info<T>::format(ss, arg);
-          };
-          (m(args), ...);
-          std::println("FAT!!! [{}] {} {}: {}", now, levstr(level), dotted<area..., message>(), ss.str());
-          std::cout << std::endl;
-          abort();
-          return {nullptr};
+      if constexpr (fixed_size) {
+        static_assert(est_len < 65536);
+      } else {
+        len = std::apply([&](const auto&... p) { return (log_length<Args>(p) + ... + 0); }, prepared);
+        len = (len + 7ULL) & ~7ULL;
+      }
+
+#ifdef NDEBUG
+      // Release
+      constexpr bool echo = (level == level_e::warn) || (level == level_e::error) || (level == level_e::fatal);
 #else
-          std::cout << "Log Frame too fat" << std::endl;
-          abort();
-          return {nullptr};
+      // Debug
+      bool echo = (level == level_e::warn) || (level == level_e::error) || (level == level_e::fatal) ||
+                  (!log_message_disable<msg_data>::is_disabled.load(std::memory_order_relaxed));
 #endif
+      auto echo_formatted = [&](const void* frame) {
+        std::stringstream ss;
+        bool first = true;
+        auto m = [&]<typename T>(const T& arg) {
+          if (!first)
+            ss << ", ";
+          first = false;
+          ss << log_name<T>::name() << " = ";
+          log_info<T>::format(ss, arg);
+        };
+        (m(args), ...);
+        log_text(std::format(
+            "[{} {:#x}] {} {}: {}", log_clock_time(now), size_t(frame), levstr(level), dotted<area..., message>(), ss.str()));
+        if constexpr ((level == level_e::fatal)) {
+          log_text_flush();
+          nie::fatal(std::format("{}: {}", dotted<area..., message>(), ss.str()));
         }
-        // #endif
-        assert(ll.length < 65536);
-        assert((len >= ll.length) || (est_len >= 65536));
-        len = ll.length;
-      }
-
-      auto frame = log_frame(len, index, now);
-      if (frame) [[likely]] {
+      };
+      if constexpr (!fixed_size)
+        if (len >= log_variable_size) [[unlikely]] {
+          simple_logger<log_split_writer> sw;
+          char* frame = nullptr;
+          if ((sw.frame = sw.begin(len, index, now))) {
+            describe_frame<level, message, Args...>(index);
+            n(sw);
+            frame = sw.finish();
+          }
+          // Too large for the scratch buffer the text sink renders from, so the text is formatted here.
+          if constexpr (level != level_e::internal)
+            if (echo)
+              echo_formatted(frame);
+          return log_cookie{frame};
+        }
+      auto frame = reserved ? reserved : log_frame(len, index, now);
+      // Frames reserved by a batch were described when they were reserved; nested frames may have moved the chunk since.
+      if (frame && !reserved)
+        describe_frame<level, message, Args...>(index);
+      // The text sink renders from the binary payload, so it is produced even if there is no log file to put it in.
+      auto payload = ((level != level_e::internal) && echo && !frame) ? log_scratch() : frame;
+      if (payload) [[likely]] {
         struct block_log {
           size_t leftover = 0;
           char* ptr = nullptr;
@@ -484,44 +900,25 @@ namespace nie {
         simple_logger<block_log> bl;
         bl.frame = frame;
         bl.leftover = len;
-        bl.ptr = frame;
+        bl.ptr = payload;
         n(bl);
         while (size_t(bl.ptr) % 8)
           *(bl.ptr++) = 0;
+        if (frame)
+          log_commit(frame);
       }
-#ifdef NDEBUG
-      // Release
-      if constexpr ((level == level_e::warn) || (level == level_e::error) || (level == level_e::fatal))
-#else
-      // Debug
-      if ((level == level_e::warn) || (level == level_e::error) || (level == level_e::fatal) ||
-          (!log_message_disable<msg_data>::is_disabled))
-#endif
-        if constexpr (level != level_e::internal) {
+      if constexpr (level != level_e::internal)
+        if (echo) {
           if (frame)
             if (!log_message_disable<msg_data>::init_cookie) {
               std::println("Init Cookie Error");
               abort();
             }
-          std::stringstream ss;
-          bool first = true;
-          auto m = [&]<typename T>(const T& arg) {
-            if (!first)
-              ss << ", ";
-            first = false;
-            ss << log_name<T>::name() << " = ";
-            log_info<T>::format(ss, arg);
-          };
-          (m(args), ...);
-          if constexpr ((level == level_e::fatal)) {
-            write_log_file(std::format("[{} {:#x}] {} {}: {}", now, size_t(frame), levstr(level), dotted<area..., message>(), ss.str()));
-            std::println("[{} {:#x}] {} {}: {}", now, size_t(frame), levstr(level), dotted<area..., message>(), ss.str());
-            std::cout << std::endl;
-            nie::fatal(std::format("{}: {}", dotted<area..., message>(), ss.str()));
-          } else {
-            write_log_file(std::format("[{} {:#x}] {} {}: {}", now, size_t(frame), levstr(level), dotted<area..., message>(), ss.str()));
-            std::println("[{} {:#x}] {} {}: {}", now, size_t(frame), levstr(level), dotted<area..., message>(), ss.str());
-          }
+          if constexpr ((level == level_e::fatal) || (log_sync_text<Args> || ...))
+            echo_formatted(frame);
+          else
+            // The sink keeps the view and caches by its address, so it must point into the static descriptor.
+            log_text(descriptor_text<level, message, Args...>(), now, frame, std::span<const char>(payload, len));
         }
       return log_cookie{frame};
     }
@@ -538,6 +935,12 @@ namespace nie {
   }
 
 } // namespace nie
+#define NIE_LOG(logger, level, message, ...)                                                                                               \
+  do {                                                                                                                                     \
+    if constexpr (nie::log_level_enabled<nie::level_e::level>)                                                                             \
+      (logger).template level<message>(__VA_ARGS__);                                                                                       \
+  } while (0)
+
 inline void bleh(std::source_location location = std::source_location::current()) {
   nie::logger<>{}.trace<"bleh">("location"_log = location);
 }
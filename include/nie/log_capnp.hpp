@@ -2,7 +2,9 @@
 #define NIE_LOG_CAPNP_HPP
 
 #include "log.hpp"
+#include <capnp/any.h>
 #include <capnp/dynamic.h>
+#include <capnp/message.h>
 #include <capnp/schema.h>
 
 namespace nie {
@@ -27,9 +29,35 @@ namespace nie {
     // using well = void;
   };
 
+  // Messages are flattened into thread-local words that are reused from one log call to the next. While one argument holds
+  // them, others in the same call get an array of their own.
+  struct log_capnp_scratch {
+    inline static thread_local kj::Array<capnp::word> words;
+    inline static thread_local bool busy = false;
+  };
+  struct log_capnp_flat {
+    uint64_t id = 0;
+    std::span<const char> data;
+    kj::Array<capnp::word> owned;
+    bool scratch = false;
+    inline log_capnp_flat() = default;
+    inline log_capnp_flat(log_capnp_flat&& o)
+        : id(o.id), data(o.data), owned(kj::mv(o.owned)), scratch(std::exchange(o.scratch, false)) {}
+    log_capnp_flat& operator=(log_capnp_flat&&) = delete;
+    inline ~log_capnp_flat() {
+      if (scratch)
+        log_capnp_scratch::busy = false;
+    }
+  };
+  // Schemas of generated types are registered once per log generation without looking the id up.
+  template <typename Reads> struct log_capnp_type {
+    inline static std::atomic<uint32_t> logged_generation = 0;
+  };
+
   template <nie::string_literal a, typename T> struct log_info<log_param<a, T>, typename base<T>::well> {
     static constexpr auto name = "capnp"_lit;
     static constexpr size_t size = 65536;
+    static constexpr bool sync_text = true;
     using B = typename base<T>::type;
     using R = capnp::ReaderFor<B>;
 
@@ -104,23 +132,60 @@ namespace nie {
         return capnp::Schema::from<typename R::Reads>();
     }
 
-    inline static void write(auto& logger, const log_param<a, T>& v) {
-      auto s = schema(v.value);
-      register_capnp(s.getProto().getId(), [&] { nie::logger<>{}.info<"capnp">("schema"_log = s.getProto()); });
-      std::span<const char> str;
+    inline static void register_schema(R v) {
+      auto s = schema(v);
+      register_capnp(s.getProto().getId(), [&] { nie::logger<>{}.registration<"capnp">("schema"_log = s.getProto()); });
+    }
+
+    // Copies the message into one flat segment, once for both sizing and writing.
+    inline static log_capnp_flat prepare(const log_param<a, T>& v) {
+      log_capnp_flat out;
+      auto flatten = [&](auto r) {
+        size_t words = r.totalSize().wordCount + 1;
+        kj::ArrayPtr<capnp::word> backing;
+        if (!log_capnp_scratch::busy) {
+          auto& scratch = log_capnp_scratch::words;
+          if (scratch.size() < words)
+            scratch = kj::heapArray<capnp::word>(std::max(words, scratch.size() * 2));
+          backing = scratch.slice(0, words);
+          log_capnp_scratch::busy = out.scratch = true;
+        } else {
+          out.owned = kj::heapArray<capnp::word>(words);
+          backing = out.owned;
+        }
+        memset(backing.begin(), 0, words * sizeof(capnp::word));
+        capnp::FlatMessageBuilder builder(backing);
+        builder.setRoot(r);
+        auto segment = builder.getSegmentsForOutput()[0];
+        out.data = std::span<const char>(reinterpret_cast<const char*>(segment.begin()), segment.size() * sizeof(capnp::word));
+      };
       if constexpr (is_dynamic<typename R::Reads>::value) {
         using AR = capnp::AnyStruct::Reader;
-        auto r = v.value.operator AR();
-        auto c = r.canonicalize();
-        str = std::span<const char>(reinterpret_cast<const char*>(c.begin()), reinterpret_cast<const char*>(c.end()));
+        out.id = schema(v.value).getProto().getId();
+        register_schema(v.value);
+        flatten(v.value.operator AR());
       } else {
-        R r = v.value;
-        auto c = capnp::canonicalize(r);
-        str = std::span<const char>(reinterpret_cast<const char*>(c.begin()), reinterpret_cast<const char*>(c.end()));
+        using type = log_capnp_type<typename R::Reads>;
+        out.id = capnp::typeId<typename R::Reads>();
+        auto generation = log_generation.load(std::memory_order_relaxed);
+        if (type::logged_generation.load(std::memory_order_relaxed) != generation) [[unlikely]] {
+          register_schema(v.value);
+          type::logged_generation.store(generation, std::memory_order_relaxed);
+        }
+        flatten(R(v.value));
       }
-      logger.template write_int<uint64_t>(s.getProto().getId());
-      logger.template write_int<uint32_t>(str.size());
-      logger.write(str.data(), str.size());
+      return out;
+    }
+    inline static size_t length(const log_capnp_flat& flat) {
+      return sizeof(uint64_t) + sizeof(uint32_t) + flat.data.size();
+    }
+    inline static void write(auto& logger, const log_capnp_flat& flat) {
+      logger.template write_int<uint64_t>(flat.id);
+      logger.template write_int<uint32_t>(flat.data.size());
+      logger.write(flat.data.data(), flat.data.size());
+    }
+    inline static void write(auto& logger, const log_param<a, T>& v) {
+      write(logger, prepare(v));
     }
     inline static void format(std::stringstream& ss, const log_param<a, T>& v) {
       if constexpr (is_dynamic<typename R::Reads>::value)
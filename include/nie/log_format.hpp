@@ -0,0 +1,141 @@
+#ifndef NIE_LOG_FORMAT_HPP
+#define NIE_LOG_FORMAT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// On-disk layout of .nielog files, shared by the writer in log.cpp and the offline reader.
+namespace nie {
+  enum class log_clock_e : uint64_t { tai, monotonic_coarse, tsc };
+
+  // Frame times are raw ticks of the clock the writer picked; this maps them back to TAI microseconds.
+  struct log_clock_t {
+    log_clock_e kind = log_clock_e::tai;
+    uint64_t tick_base = 0;
+    uint64_t tai_base = 0;
+    uint64_t ticks_per_second = 1000000;
+    inline uint64_t tai(uint64_t ticks) const {
+      auto delta = int64_t(ticks - tick_base);
+      auto rate = int64_t(ticks_per_second);
+      return tai_base + ((delta / rate) * 1000000) + (((delta % rate) * 1000000) / rate);
+    }
+  };
+  static_assert(sizeof(log_clock_t) == 32);
+
+  // Readers refuse other versions; bump it with any change to the layout of the header or the frames.
+  constexpr uint32_t log_version = 2;
+  struct log_buffer_t {
+    volatile uint64_t signature;
+    // Bytes handed out to per-thread chunks, not bytes written; see log_frame.
+    std::atomic<uint64_t> content_length = sizeof(log_buffer_t);
+    log_clock_t clock;
+    // A thread moves to a new chunk once its current one is this many ticks old, 0 if unbounded. This bounds how far
+    // back from the end a recent frame can be.
+    uint64_t chunk_age = 0;
+    uint32_t version = log_version;
+    uint32_t chunk_size = 0;
+    // TAI microseconds when the file was started.
+    uint64_t start_time = 0;
+    // GNU build id of the executable that wrote the file; descriptor indexes are offsets into its image.
+    uint32_t build_id_size = 0;
+    uint8_t build_id[44] = {};
+  };
+  static_assert(sizeof(std::atomic<uint64_t>) == 8);
+  static_assert(sizeof(log_buffer_t) == 120);
+  struct log_frame_t {
+    volatile uint64_t time;
+    // Total size including this header; log_frame_committed is set once the payload is complete.
+    std::atomic<uint32_t> size;
+    volatile uint32_t index;
+    char data[];
+    inline log_frame_t(size_t size, uint32_t index, uint64_t time) : time(time), size(size), index(index) {}
+    log_frame_t() = delete;
+    log_frame_t(const log_frame_t&) = delete;
+    log_frame_t(log_frame_t&&) = delete;
+    log_frame_t& operator=(const log_frame_t&) = delete;
+    log_frame_t& operator=(log_frame_t&&) = delete;
+  };
+  static_assert(sizeof(log_frame_t) == 16);
+  constexpr uint32_t log_frame_committed = 0x80000000U;
+  constexpr uint32_t log_frame_size_mask = 0x0FFFFFFFU;
+
+  // A payload too large for one frame is split. The head frame has log_frame_continued set and its payload starts with
+  // log_continued_t; the rest follows in continuation frames that carry the head's time, log_continuation_index and the
+  // key as their first 8 bytes. One thread writes them in file order and commits the head last, so a committed head has
+  // all its continuations committed before it.
+  constexpr uint32_t log_frame_continued = 0x40000000U;
+  constexpr uint32_t log_continuation_index = uint32_t(-2);
+  constexpr size_t log_frame_payload_max = 65528;
+  struct log_continued_t {
+    // Payload bytes across the head and its continuations, without this header or the continuation keys.
+    uint64_t length;
+    uint64_t key;
+  };
+
+  // Frames are carved out of per-thread chunks laid out back to back after the buffer header, so every chunk boundary is
+  // also a frame boundary. The unused tail of a chunk is always covered by a padding frame.
+  constexpr uint32_t log_padding_index = uint32_t(-1);
+  constexpr size_t log_chunk_size = 262144;
+  constexpr size_t log_data_start = sizeof(log_buffer_t);
+  constexpr uint64_t log_signature = 724313520984115539ULL;
+
+  // With log.checksum on, a chunk a thread is done with ends in a seal frame: log_seal_t at the last log_seal_size bytes
+  // of the chunk, with time 0 and log_seal_index. Chunks still open when the file was closed have none.
+  constexpr uint32_t log_seal_index = uint32_t(-3);
+  struct log_seal_t {
+    // CRC32C of the chunk's bytes before the seal frame.
+    uint32_t crc;
+    uint32_t length;
+  };
+  constexpr size_t log_seal_size = sizeof(log_frame_t) + sizeof(log_seal_t);
+  // CRC32C (Castagnoli) continuing from crc, which is 0 to start; uses the SSE4.2 crc32 instruction where available.
+  uint32_t log_crc32c(uint32_t crc, const void* data, size_t size);
+
+  // A finished log compressed in independently decodable blocks, each covering log_block_size bytes of chunks. The file
+  // is this header, the blocks and then blocks entries of log_block_t locating them.
+  enum class log_codec_e : uint64_t { none, bzip2 };
+  struct log_compressed_t {
+    volatile uint64_t signature;
+    log_codec_e codec;
+    // Bytes of the original log covered, its header included.
+    uint64_t content_length;
+    uint64_t blocks;
+    uint64_t index_offset;
+    // The original log_buffer_t.
+    char header[sizeof(log_buffer_t)];
+  };
+  struct log_block_t {
+    uint64_t offset;
+    uint64_t size;
+  };
+  constexpr size_t log_block_size = 16 * log_chunk_size;
+  constexpr uint64_t log_compressed_signature = 724313520984115538ULL;
+
+  // Live tap: a shared memory ring named /nielog.<executable>.<pid> that one local collector at a time attaches to by
+  // storing its pid in attached. Producers copy committed frames in and drop them, counting the drop, when the ring is
+  // full. The collector reads frames in place and zeroes what it consumed before moving tail on. A frame never wraps;
+  // the end of the ring is skipped with a padding frame, or silently if fewer than 16 bytes are left. A collector that
+  // attaches resets the ring with head closed, once the producers still copying for its predecessor have left.
+  struct log_tap_t {
+    volatile uint64_t signature;
+    uint64_t size;
+    log_clock_t clock;
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<uint64_t> attached = 0;
+    // Producers between reading head and committing their copy.
+    std::atomic<uint64_t> writers = 0;
+    inline char* data() {
+      return reinterpret_cast<char*>(this + 1);
+    }
+  };
+  constexpr uint64_t log_tap_signature = 724313520984115537ULL;
+  // Set in log_tap_t::head while a collector resets the ring; producers drop their frames meanwhile.
+  constexpr uint64_t log_tap_closed = 1ULL << 63;
+  static_assert(log_chunk_size > (65536 + 2 * sizeof(log_frame_t)));
+} // namespace nie
+
+#endif // NIE_LOG_FORMAT_HPP
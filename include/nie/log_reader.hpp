@@ -0,0 +1,186 @@
+#ifndef NIE_LOG_READER_HPP
+#define NIE_LOG_READER_HPP
+
+#include "log.hpp"
+#include "log_format.hpp"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nie::log_reader {
+  struct field_t {
+    std::string_view type;
+    std::string_view name;
+  };
+  // Parsed form of the "0:level:len:area.message:A:type:len:name::" text do_log writes once per message.
+  struct descriptor_t {
+    uint32_t index = 0;
+    nie::level_e level = nie::level_e::info;
+    std::string_view message;
+    std::vector<field_t> fields;
+  };
+  std::optional<descriptor_t> parse_descriptor(std::string_view text);
+
+  struct value_t {
+    enum class kind_e {
+      boolean,
+      signed_integer,
+      unsigned_integer,
+      pointer,
+      string,
+      formatted,
+      binary,
+      cached_string,
+      source_location,
+      cookie,
+      capnp
+    };
+    kind_e kind;
+    uint64_t number = 0;
+    std::string_view bytes;
+  };
+
+  // Turns the ids that frames carry for nie::string and source_location arguments back into text.
+  struct resolver_t {
+    virtual std::optional<std::string_view> string(uint64_t) const = 0;
+    virtual std::optional<std::string_view> source_location(uint32_t) const = 0;
+  };
+
+  // Calls cb(field, value) for every argument in the payload, returns false if the payload does not match the descriptor.
+  bool visit_fields(const descriptor_t&, std::span<const char> payload, const nie::function_ref<void(const field_t&, const value_t&)>& cb);
+  // A cookie is the distance back to the frame it refers to; given where this frame is, it is shown as where that one is.
+  void format_text(std::string& out, const descriptor_t&, std::span<const char> payload, const resolver_t*, uint64_t frame = 0);
+  void format_json(std::string& out, const descriptor_t&, std::span<const char> payload, const resolver_t*);
+  std::string format_time(uint64_t time);
+
+  struct entry_t {
+    // TAI microseconds, converted from the writer's clock ticks with the calibration in the file header.
+    uint64_t time;
+    uint64_t offset;
+    uint32_t index;
+    nie::level_e level;
+  };
+
+  struct verify_t {
+    size_t chunks = 0;
+    // Chunks ending in a seal frame, see log.checksum; the others were still open or written without checksums.
+    size_t sealed = 0;
+    // Offsets of the sealed chunks whose CRC32C does not match.
+    std::vector<uint64_t> corrupt;
+  };
+
+  struct file_t final : resolver_t {
+    static nie::errorable<std::unique_ptr<file_t>> open(const std::string& path);
+    file_t(const file_t&) = delete;
+    file_t& operator=(const file_t&) = delete;
+    ~file_t();
+
+    // Scans the file with the given number of threads (0 picks one per core) and sorts the frames by time, level and message.
+    void build_index(size_t threads = 0);
+    // Indexes only the frames of the last given seconds before the newest one, reading from the end of the file. Meant for
+    // logs left behind by a crash, where only frames that were committed are seen. Logs written without log.chunk_max_age
+    // are read whole, since any chunk may hold recent frames.
+    void build_tail_index(uint64_t seconds);
+    inline std::span<const entry_t> entries() const {
+      return entries_;
+    }
+    std::span<const entry_t> between(uint64_t from, uint64_t to) const;
+    const descriptor_t* descriptor(uint32_t index) const;
+    std::span<const char> payload(const entry_t&) const;
+    std::string text(const entry_t&) const;
+    std::string json(const entry_t&) const;
+    // The version, build id, start time and clock calibration the writer recorded.
+    const nie::log_buffer_t& header() const;
+    // Checks the seals of all chunks with the given number of threads (0 picks one per core); needs no index.
+    verify_t verify(size_t threads = 0) const;
+
+    std::optional<std::string_view> string(uint64_t) const override;
+    std::optional<std::string_view> source_location(uint32_t) const override;
+
+  private:
+    file_t() = default;
+    size_t chunks() const;
+    // Makes sure the blocks of a compressed log covering [begin, end) are inflated.
+    void inflate(size_t begin, size_t end) const;
+    void walk(size_t chunk, const nie::function_ref<void(size_t, uint64_t, uint32_t)>& f) const;
+    void add_descriptor(uint32_t index, uint64_t offset);
+    void add_registration(const entry_t&);
+    void add_continuation(uint64_t offset);
+    std::span<const char> join(uint64_t offset, std::span<const char> head) const;
+    void sort_entries(std::vector<entry_t>&) const;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t end_ = 0;
+    nie::log_clock_t clock_;
+    // log_buffer_t::chunk_age in microseconds.
+    uint64_t chunk_age_ = 0;
+    const char* compressed_ = nullptr;
+    size_t compressed_size_ = 0;
+    nie::log_codec_e codec_ = nie::log_codec_e::none;
+    std::vector<nie::log_block_t> blocks_;
+    std::unique_ptr<std::once_flag[]> inflated_;
+    std::unordered_map<uint32_t, descriptor_t> descriptors_;
+    std::vector<entry_t> entries_;
+    std::unordered_map<uint64_t, std::string_view> strings_;
+    std::unordered_map<uint32_t, std::string> locations_;
+    // Continuation frame offsets by key and the split payloads put back together so far, see log_frame_continued.
+    std::unordered_map<uint64_t, std::vector<uint64_t>> continuations_;
+    mutable std::mutex joined_mutex_;
+    mutable std::unordered_map<uint64_t, std::string> joined_;
+  };
+
+  // Writes entries as one directory per message (named after it and its descriptor index) holding a column per field, for
+  // analytics that should not decode frames. Fixed-width fields are packed little-endian arrays in <field>.<type>;
+  // strings, binaries and capnp payloads are a <field>.offsets array of row count + 1 uint64 end offsets into
+  // <field>.data. Time is @time.uint64 in TAI microseconds and schema.json lists the columns. Cached strings and source
+  // locations stay ids, resolved by the strings.* and locations.* dictionaries next to the message directories. Frames
+  // that do not decode are skipped; returns the number of rows written.
+  nie::errorable<size_t> export_columns(const file_t&, std::span<const entry_t>, const std::string& directory);
+
+  // Block codecs of compressed logs, see log_compressed_t.
+  bool compress_block(nie::log_codec_e, int level, std::span<const char> in, std::string& out);
+  bool inflate_block(nie::log_codec_e, std::span<const char> in, std::span<char> out);
+  // Compresses a finished .nielog into out, which appears under its name only once complete. Blocks are compressed by the
+  // given number of threads (0 picks one per core). Returns the compressed size.
+  nie::errorable<size_t> compress_file(const std::string& path, const std::string& out, nie::log_codec_e, int level, size_t threads = 0);
+
+  // Collector side of a running process's live tap (see log.tap). Frames are read in place from the shared memory ring;
+  // descriptors and registrations are copied out since the ring is reused.
+  struct tap_t final : resolver_t {
+    // Takes a shared memory name such as /nielog.app.1234 and fails if another collector is attached.
+    static nie::errorable<std::unique_ptr<tap_t>> attach(const std::string& name);
+    tap_t(const tap_t&) = delete;
+    tap_t& operator=(const tap_t&) = delete;
+    ~tap_t();
+
+    // Calls cb for every frame that arrived since the last call, returns the number of frames consumed. entry_t::offset
+    // is the frame's position in the stream.
+    size_t poll(const nie::function_ref<void(const entry_t&, std::span<const char>)>& cb);
+    uint64_t dropped() const;
+    const descriptor_t* descriptor(uint32_t index) const;
+    std::string text(const entry_t&, std::span<const char> payload) const;
+    std::string json(const entry_t&, std::span<const char> payload) const;
+
+    std::optional<std::string_view> string(uint64_t) const override;
+    std::optional<std::string_view> source_location(uint32_t) const override;
+
+  private:
+    tap_t() = default;
+    nie::log_tap_t* tap_ = nullptr;
+    size_t mapped_ = 0;
+    std::unordered_map<uint32_t, std::pair<std::string, descriptor_t>> descriptors_;
+    std::unordered_map<uint64_t, std::string> strings_;
+    std::unordered_map<uint32_t, std::string> locations_;
+    // Continuations wait here for their head, which is committed after them.
+    std::unordered_map<uint64_t, std::string> continued_;
+    uint64_t dropped_seen_ = 0;
+  };
+} // namespace nie::log_reader
+
+#endif // NIE_LOG_READER_HPP
@@ -2,8 +2,16 @@
 #define string_LITERAL_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <format>
+#include <span>
+#include <string>
 #include <string_view>
+#include <system_error>
 
 namespace nie {
   struct string;
@@ -109,13 +117,89 @@ namespace nie {
   };
   template <size_t v> constexpr auto to_string = to_string_t<v>::value;
 
+  // 64-bit string hash that gives the same result at compile time and at runtime. Whole 32 byte stripes feed eight
+  // independent 32-bit lanes, so the runtime version can take a stripe per vector instruction; the rest is mixed in
+  // byte-wise.
+  namespace string_hash_detail {
+    inline constexpr uint32_t prime32_1 = 0x9E3779B1U;
+    inline constexpr uint32_t prime32_2 = 0x85EBCA77U;
+    inline constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87ULL;
+    inline constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+    inline constexpr uint64_t prime64_3 = 0x165667B19E3779F9ULL;
+    inline constexpr size_t stripe = 32;
+    using lanes_t = std::array<uint32_t, 8>;
+
+    constexpr uint32_t load32(const char* p) {
+      return uint32_t(uint8_t(p[0])) | (uint32_t(uint8_t(p[1])) << 8) | (uint32_t(uint8_t(p[2])) << 16) | (uint32_t(uint8_t(p[3])) << 24);
+    }
+    constexpr uint64_t load64(const char* p) {
+      return uint64_t(load32(p)) | (uint64_t(load32(p + 4)) << 32);
+    }
+    constexpr lanes_t seed() {
+      lanes_t lanes;
+      for (size_t i = 0; i < lanes.size(); i++)
+        lanes[i] = prime32_1 * uint32_t(i + 1);
+      return lanes;
+    }
+    // Consumes stripes * 32 bytes.
+    constexpr void stripes(lanes_t& lanes, const char* p, size_t stripes) {
+      for (; stripes; stripes--, p += stripe)
+        for (size_t i = 0; i < lanes.size(); i++)
+          lanes[i] = std::rotl(lanes[i] + (load32(p + (i * 4)) * prime32_2), 13) * prime32_1;
+    }
+    // Mixes in the lanes and the n < 32 trailing bytes at p.
+    constexpr uint64_t finish(const lanes_t& lanes, const char* p, size_t n, size_t size) {
+      uint64_t h = (uint64_t(size) * prime64_1) ^ prime64_3;
+      if (size >= stripe)
+        for (auto lane : lanes)
+          h = std::rotl((h ^ lane) * prime64_2, 31);
+      for (; n >= 8; n -= 8, p += 8)
+        h = std::rotl(h ^ (load64(p) * prime64_2), 27) * prime64_1;
+      for (; n; n--, p++)
+        h = std::rotl(h ^ (uint8_t(*p) * prime64_3), 11) * prime64_1;
+      h ^= h >> 33;
+      h *= prime64_2;
+      h ^= h >> 29;
+      h *= prime64_3;
+      h ^= h >> 32;
+      return h;
+    }
+    constexpr uint64_t scalar(std::string_view text) {
+      auto lanes = seed();
+      stripes(lanes, text.data(), text.size() / stripe);
+      auto tail = text.size() % stripe;
+      return finish(lanes, text.data() + (text.size() - tail), tail, text.size());
+    }
+  } // namespace string_hash_detail
+  [[gnu::visibility("default"), gnu::pure]] uint64_t string_hash_vector(std::string_view);
+  constexpr uint64_t string_hash(std::string_view text) {
+    if consteval {
+      return string_hash_detail::scalar(text);
+    } else {
+      return string_hash_vector(text);
+    }
+  }
+
+  // Interned strings are this header directly followed by their characters, so text() is a plain load. hash is
+  // string_hash of the text, computed once when the string is interned.
   struct string_data {
-    [[gnu::const]] virtual std::string_view text() const = 0;
+    uint64_t hash;
+    uint32_t size;
+    // Log generation this string was last registered in, see register_nie_string.
+    mutable std::atomic<uint32_t> logged_generation = 0;
+    [[gnu::pure]] inline std::string_view text() const {
+      return std::string_view(reinterpret_cast<const char*>(this) + sizeof(string_data), size);
+    }
   };
+  static_assert(sizeof(string_data) == 16);
+
   struct string {
     template <nie::string_literal T> friend struct string_init;
     friend struct std::hash<string>;
     explicit string(std::string_view);
+    // Interns texts[i] into out[i] and returns the filled part of out. Large batches are hashed and looked up on several
+    // threads before any lock is taken; the new strings then take each shard's lock once.
+    static std::span<string> intern(std::span<const std::string_view> texts, std::span<string> out);
     string() = default;
     string(const string&) = default;
     string(string&&) = default;
@@ -141,20 +225,50 @@ namespace nie {
     string_data const* data_ = nullptr;
   };
 
+  struct string_stats_t {
+    // Literals in the per-module tables and strings in the runtime table, which includes restored ones.
+    size_t literals = 0;
+    size_t entries = 0;
+    // Header and text bytes of the strings added at runtime, and the arena memory holding them.
+    size_t bytes = 0;
+    size_t reserved = 0;
+    // Strings that came from snapshots, see restore_strings, and the size of the files mapped for them.
+    size_t restored = 0;
+    size_t mapped = 0;
+    // Lookups from text that found an interned string, and those that had to add one.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+  [[gnu::visibility("default")]] string_stats_t string_stats();
+  // Writes the runtime table to path in the layout its strings have in memory, for restore_strings on the next start.
+  [[gnu::visibility("default")]] std::error_code save_strings(const std::string& path);
+  // Maps a file written by save_strings and interns its strings where they lie, without copying or hashing them. Text
+  // that is interned already is skipped, so this is best called early in main.
+  [[gnu::visibility("default")]] std::error_code restore_strings(const std::string& path);
+
+#if !defined(__clang__)
   [[gnu::visibility("default")]] void register_literal(string_data const*);
+#endif
 
   template <nie::string_literal T> struct string_init {
-    struct my_string_data final : string_data {
-      inline my_string_data() {
-        register_literal(this);
-      }
-      [[gnu::const]] std::string_view text() const override {
-        return T();
-      }
+    static constexpr uint64_t hash = string_hash(T());
+    struct my_string_data {
+      string_data header = {hash, uint32_t(T().size())};
+      decltype(T) chars = T;
     };
-    [[gnu::visibility("default")]] inline static const my_string_data data_ = {};
+    static_assert(offsetof(my_string_data, chars) == sizeof(string_data));
+    [[gnu::visibility("default")]] constinit inline static my_string_data data_ = {};
+#if defined(__clang__)
+    // The linker collects these into a table per module that nie::string(std::string_view) searches before the runtime
+    // strings, so literals need no registration during static initialization.
+    [[gnu::used, gnu::retain, gnu::section("nie_strlit")]] inline static string_data const* const record = &data_.header;
+#else
+    // GCC ignores section attributes on members of class templates, so there the literal is interned at startup instead.
+    inline static const bool record = (register_literal(&data_.header), true);
+#endif
     inline string operator()() {
-      return string(&data_);
+      static_cast<void>(&record);
+      return string(&data_.header);
     }
   };
   template <> struct string_init<""> {
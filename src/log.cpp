@@ -1,32 +1,124 @@
+#include <array>
 #include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <deque>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <nie/log.hpp>
+#include <nie/concurrentqueue.h>
+#include <nie/log_format.hpp>
+#include <nie/log_reader.hpp>
+#include <set>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #if defined(_WIN32)
 #include <windows.h>
 #else
+#include <csignal>
+#include <elf.h>
+#include <link.h>
+#include <linux/membarrier.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #endif
+#if defined(__x86_64__) && !defined(_M_X64)
+#include <cpuid.h>
+#endif
 
 namespace nie::log {
-  struct nie_log_buffer_t {
-    volatile uint64_t signature;
-    std::atomic<uint64_t> content_length = 16;
+  // One mapped log file. Segments are never freed, only unmapped, so a producer may still look at one it lost the race for.
+  struct log_segment_t {
+    nie::log_buffer_t* buffer = nullptr;
+    size_t size = 0;
+    int fd = -1;
+    uint64_t number = 0;
+    std::atomic<uint64_t> users = 0;
+    std::atomic<log_segment_t*> next = nullptr;
   };
-  static_assert(sizeof(std::atomic<uint64_t>) == 8);
-  static_assert(sizeof(nie_log_buffer_t) == 16);
-  nie_log_buffer_t* nie_log_buffer_output = nullptr;
+  std::atomic<log_segment_t*> current_segment = nullptr;
+  bool segmented = false;
+  std::atomic<uint64_t> dropped_frames = 0;
 } // namespace nie::log
 
 namespace nie {
+  std::atomic<uint32_t> log_generation = 1;
+
+  nie::tuneable<bool> log_segmented("log.segmented", "Roll the log over into numbered segment files instead of one fixed file", false);
+  nie::tuneable<size_t> log_segment_size("log.segment_size", "Size of one log segment file in bytes", 2147483648ULL);
+  nie::tuneable<size_t> log_segment_keep("log.segment_keep", "Number of finished log segments kept on disk, 0 keeps all", 0);
+  nie::tuneable<size_t> log_limit_summary_interval(
+      "log.limit_summary_interval", "Seconds between frames summarising sampled and rate limited log events", 10);
+  // Each thread that logs within an age starts a new chunk per age however little it writes, so the log grows by up to
+  // 256 KiB per logging thread per age; with 64 threads and an age of 10 s a 2 GiB buffer fills in about 20 minutes.
+  nie::tuneable<size_t> log_chunk_max_age("log.chunk_max_age",
+      "Seconds after which a thread starts a new log chunk, so crash recovery only reads the tail; 0 never ages chunks out",
+      0);
+  nie::tuneable<uint32_t> log_clock_source(
+      "log.clock", "Frame timestamp source: 0 TAI clock, 1 coarse monotonic clock, 2 invariant TSC (falls back to 1)", 2);
+
+  nie::tuneable<uint32_t> log_compress_codec(
+      "log.compress", "Codec finished log segments are compressed with into .nielogz files: 0 none, 1 bzip2", 0);
+  nie::tuneable<uint32_t> log_compress_level("log.compress_level", "Compression level for finished log segments, 1 to 9", 9);
+  nie::tuneable<bool> log_checksum(
+      "log.checksum", "End every log chunk a thread is done with in a seal frame holding its CRC32C, see nielog --verify", false);
+  nie::tuneable<bool> log_tap_enabled("log.tap", "Offer frames to a local collector through a shared memory ring", false);
+  nie::tuneable<size_t> log_tap_size("log.tap_size", "Size of the live tap ring in bytes, rounded up to a power of two", 67108864);
+
+  nie::log_clock_t log_clock;
+  uint64_t log_chunk_age = 0;
+  std::atomic<bool> log_tap_attached = false;
+  nie::log_tap_t* log_tap = nullptr;
+
+  // Pairs a tick reading with the TAI clock and, for the TSC, measures its rate against the monotonic clock.
+  nie::log_clock_t log_calibrate_clock(nie::log_clock_e kind) {
+    using namespace std::chrono;
+    nie::log_clock_t clock;
+#if defined(__x86_64__) || defined(_M_X64)
+    if (kind == nie::log_clock_e::tsc) {
+      unsigned int regs[4] = {};
+#if defined(_M_X64)
+      __cpuid(reinterpret_cast<int*>(regs), 0x80000007);
+#else
+      __cpuid(0x80000007, regs[0], regs[1], regs[2], regs[3]);
+#endif
+      if (!(regs[3] & (1U << 8)))
+        kind = nie::log_clock_e::monotonic_coarse;
+    }
+#else
+    if (kind == nie::log_clock_e::tsc)
+      kind = nie::log_clock_e::monotonic_coarse;
+#endif
+#if !defined(__linux__)
+    if (kind == nie::log_clock_e::monotonic_coarse)
+      kind = nie::log_clock_e::tai;
+#endif
+    clock.kind = kind;
+    if (kind == nie::log_clock_e::tai)
+      return clock;
+    log_clock.kind = kind;
+    auto start = steady_clock::now();
+    clock.tick_base = log_clock_now();
+    clock.tai_base = duration_cast<microseconds>(tai_clock::now().time_since_epoch()).count();
+    if (kind == nie::log_clock_e::monotonic_coarse) {
+      clock.ticks_per_second = 1000000000ULL;
+      return clock;
+    }
+    std::this_thread::sleep_for(milliseconds(20));
+    auto ticks = log_clock_now() - clock.tick_base;
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    clock.ticks_per_second = uint64_t((double(ticks) * 1e9) / double(elapsed));
+    return clock;
+  }
+
   std::string executable_name() {
 #if defined(PLATFORM_POSIX) || defined(__linux__) // check defines for your setup
 
@@ -47,68 +139,505 @@ namespace nie {
 #endif
   }
 
-  struct log_frame_t {
-    volatile uint64_t time;
-    volatile uint32_t size;
-    volatile uint32_t index;
-    char data[];
-    inline log_frame_t(size_t size, uint32_t index, std::chrono::tai_clock::time_point time)
-        : size(size), index(index), time(std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count()) {}
-    log_frame_t() = delete;
-    log_frame_t(const log_frame_t&) = delete;
-    log_frame_t(log_frame_t&&) = delete;
-    log_frame_t& operator=(const log_frame_t&) = delete;
-    log_frame_t& operator=(log_frame_t&&) = delete;
+  // Frames are carved out of per-thread chunks, so the shared content_length is only touched once per chunk. A chunk
+  // abandoned half-used (thread exit, chunk too small for the next frame) stays walkable thanks to its padding frame.
+  constexpr size_t log_buffer_size = 2147483648ULL;
+
+  // Whether every frame in [begin, end) is committed.
+  bool log_committed(char* begin, char* end) {
+    for (auto p = begin; p < end;) {
+      auto size = reinterpret_cast<log_frame_t*>(p)->size.load(std::memory_order_acquire);
+      if (!(size & log_frame_committed))
+        return false;
+      p += size & log_frame_size_mask;
+    }
+    return true;
+  }
+
+  // Writes the seal frame after end once every frame in [begin, end) is committed.
+  bool log_seal(char* begin, char* end) {
+    if (!log_committed(begin, end))
+      return false;
+    log_seal_t seal{log_crc32c(0, begin, end - begin), uint32_t(end - begin)};
+    auto frame = new (end) log_frame_t(log_seal_size, log_seal_index, {});
+    memcpy(frame->data, &seal, sizeof(seal));
+    frame->size.store(log_seal_size | log_frame_committed, std::memory_order_release);
+    return true;
+  }
+
+  bool log_seal_chunks = false;
+
+  // Whether a chunk can be let go: all its frames committed, and sealed if log.checksum is on.
+  inline bool log_settle(char* begin, char* end) {
+    return log_seal_chunks ? log_seal(begin, end) : log_committed(begin, end);
+  }
+
+  // The owning thread only takes mtx on its slow path, the worker to revoke pins, see log_revoke_chunks.
+  struct log_chunk_t {
+    std::mutex mtx;
+    bool registered = false;
+    // Set once the worker has taken back the pin of segment; the chunk must not be touched any more.
+    bool revoked = false;
+    // Raised by the owner from its segment check until the frame header is written, and for the whole of a split
+    // payload, see log_revoke_chunks.
+    std::atomic<uint32_t> busy = 0;
+    // The segment a split payload keeps all its pieces in, so that they are joined within one file.
+    nie::log::log_segment_t* hold = nullptr;
+    nie::log::log_segment_t* segment = nullptr;
+    char* position = nullptr;
+    char* end = nullptr;
+    uint64_t deadline = 0;
+    char* begin = nullptr;
+    struct pending_t {
+      nie::log::log_segment_t* segment;
+      char* begin;
+      char* end;
+    };
+    // A chunk may be handed back while a frame in it is still being written, by a nested registration or as the head of
+    // a split payload. It stays pinned until all its frames are committed, then is sealed if log.checksum is on.
+    std::vector<pending_t> pending;
+    inline void settle(bool last) {
+      std::erase_if(pending, [&](const pending_t& p) {
+        if (!log_settle(p.begin, p.end) && !last)
+          return false;
+        p.segment->users.fetch_sub(1);
+        return true;
+      });
+    }
+    // Only the owner writes busy, so it needs no read-modify-write.
+    inline void enter() {
+      busy.store(busy.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    inline void leave() {
+      busy.store(busy.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+    // The segment frames go to: the current one, unless a split payload holds on to its own.
+    inline nie::log::log_segment_t* target() const {
+      return hold ? hold : nie::log::current_segment.load(std::memory_order_relaxed);
+    }
+    inline void release() {
+      if (segment && !revoked)
+        pending.push_back(pending_t{segment, begin, end});
+      revoked = false;
+      if (!pending.empty())
+        settle(false);
+      segment = nullptr;
+      position = nullptr;
+      end = nullptr;
+      begin = nullptr;
+    }
+    inline ~log_chunk_t();
   };
-  static_assert(sizeof(log_frame_t) == 16);
+  thread_local log_chunk_t log_chunk;
 
-  char* log_frame(uint32_t size, uint32_t index, std::chrono::tai_clock::time_point time) {
-    assert(size % 8 == 0);
-    // std::cout << "SIZE " << size << std::endl;
-    assert(size < 65536);
-    if (nie::log::nie_log_buffer_output) {
-      auto offset = nie::log::nie_log_buffer_output->content_length.fetch_add(size + sizeof(log_frame_t));
+  // Every thread's chunk, so the worker can take back the pins of threads that stopped logging.
+  struct log_chunks_t {
+    std::mutex mtx;
+    std::vector<log_chunk_t*> chunks;
+  };
+  log_chunks_t& log_chunks() {
+    static log_chunks_t x;
+    return x;
+  }
+
+  inline log_chunk_t::~log_chunk_t() {
+    if (registered) {
+      std::lock_guard lock(log_chunks().mtx);
+      std::erase(log_chunks().chunks, this);
+    }
+    release();
+    settle(true);
+  }
+
+  inline void log_pad(char* position, char* end) {
+    if (position != end)
+      new (position) log_frame_t((end - position) | log_frame_committed, log_padding_index, {});
+  }
+
+  void log_worker_wake();
+
+  // Spans the owner's check that its chunk is in the current segment and the header of the frame it then writes.
+  struct log_chunk_busy_t {
+    log_chunk_t& chunk;
+    inline log_chunk_busy_t(log_chunk_t& chunk) : chunk(chunk) {
+      chunk.enter();
+    }
+    inline ~log_chunk_busy_t() {
+      chunk.leave();
+    }
+  };
+
+  char* log_reserve_chunk(log_chunk_t& chunk) {
+    if (!chunk.registered) [[unlikely]] {
+      std::lock_guard lock(log_chunks().mtx);
+      log_chunks().chunks.push_back(&chunk);
+      chunk.registered = true;
+    }
+    std::lock_guard lock(chunk.mtx);
+    chunk.release();
+    while (auto segment = chunk.hold ? chunk.hold : nie::log::current_segment.load()) {
+      // Pin the segment before touching it; the worker only unmaps segments that are no longer current and unused. A held
+      // segment is pinned by the chunk of the split's head already.
+      segment->users.fetch_add(1);
+      if (!chunk.hold && (segment != nie::log::current_segment.load())) {
+        segment->users.fetch_sub(1);
+        continue;
+      }
+      auto offset = segment->buffer->content_length.fetch_add(log_chunk_size);
       assert(offset % 8 == 0);
-      if ((offset + size) >= 2147483648ULL) {
+      if ((offset + log_chunk_size) <= segment->size) [[likely]] {
+        chunk.segment = segment;
+        log_chunk_segment = uint32_t(segment->number);
+        chunk.position = reinterpret_cast<char*>(segment->buffer) + offset;
+        chunk.begin = chunk.position;
+        chunk.end = chunk.position + log_chunk_size - (log_seal_chunks ? log_seal_size : 0);
+        chunk.deadline = log_chunk_age ? (log_clock_now() + log_chunk_age) : uint64_t(-1);
+        log_pad(chunk.position, chunk.end);
+        return chunk.position;
+      }
+      segment->users.fetch_sub(1);
+      if (!nie::log::segmented) {
         std::cout << "Log Buffer Full" << std::endl;
         *(volatile char*)(0) = 0;
         return nullptr;
-      } else
-        return &(
-            (new (reinterpret_cast<char*>(nie::log::nie_log_buffer_output) + offset) log_frame_t(size + sizeof(log_frame_t), index, time))
-                ->data[0]);
+      }
+      auto next = segment->next.load();
+      if (!next || chunk.hold) {
+        // The worker has not prepared the next segment yet, producers never wait for it, or a split ran out of its segment.
+        nie::log::dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        log_worker_wake();
+        return nullptr;
+      }
+      if (nie::log::current_segment.compare_exchange_strong(segment, next)) {
+        log_generation.fetch_add(1, std::memory_order_release);
+        log_worker_wake();
+      }
     }
     return nullptr;
   }
 
-  void write_log_file(std::string_view m) {
-    static std::mutex mtx;
-    static std::ofstream file(executable_name() + std::string(".txt"), std::ofstream::out | std::ofstream::trunc);
-    std::unique_lock lock(mtx);
-    file << m << std::endl;
+  void log_sync() {
+#if !defined(_WIN32)
+    auto segment = nie::log::current_segment.load();
+    if (!segment)
+      return;
+    segment->users.fetch_add(1);
+    if (segment == nie::log::current_segment.load())
+      msync(segment->buffer, std::min<size_t>(segment->buffer->content_length.load(), segment->size), MS_SYNC);
+    segment->users.fetch_sub(1);
+#endif
   }
 
-  std::map<std::string, std::vector<bool*>> disablers;
-  void read_log_disabler() {
-    std::ifstream file("nolog.txt");
-    std::string line;
-    while (std::getline(file, line)) {
-      if (disablers.contains(line)) {
-        for (const auto d : disablers.at(line))
-          *d = true;
+  void log_tap_push(const log_frame_t* frame) {
+    auto tap = log_tap;
+    uint64_t total = frame->size.load(std::memory_order_relaxed) & log_frame_size_mask;
+    // Counted before head is read, so a collector that closed head sees every claim made before it did.
+    tap->writers.fetch_add(1);
+    auto head = tap->head.load();
+    uint64_t pos, skip;
+    do {
+      pos = head & (tap->size - 1);
+      skip = ((pos + total) > tap->size) ? (tap->size - pos) : 0;
+      if ((head & log_tap_closed) || ((head + skip + total - tap->tail.load(std::memory_order_acquire)) > tap->size)) {
+        tap->dropped.fetch_add(1, std::memory_order_relaxed);
+        tap->writers.fetch_sub(1, std::memory_order_release);
+        return;
       }
+    } while (!tap->head.compare_exchange_weak(head, head + skip + total, std::memory_order_release, std::memory_order_relaxed));
+    if (skip) {
+      if (skip >= sizeof(log_frame_t))
+        new (tap->data() + pos) log_frame_t(skip | log_frame_committed, log_padding_index, {});
+      pos = 0;
     }
+    auto copy = new (tap->data() + pos) log_frame_t(total, frame->index, frame->time);
+    memcpy(copy->data, frame->data, total - sizeof(log_frame_t));
+    copy->size.store(total | log_frame_committed, std::memory_order_release);
+    tap->writers.fetch_sub(1, std::memory_order_release);
   }
 
-  void add_log_disabler(std::string_view v, bool* ptr) {
+  char* log_frame(uint32_t size, uint32_t index, uint64_t time) {
+    assert(size % 8 == 0);
+    // std::cout << "SIZE " << size << std::endl;
+    assert(size < 65536);
+    auto& chunk = log_chunk;
+    log_chunk_busy_t busy(chunk);
+    size_t total = size + sizeof(log_frame_t);
+    if ((size_t(chunk.end - chunk.position) < total) || (chunk.segment != chunk.target()) ||
+        (time > chunk.deadline)) [[unlikely]]
+      if (!log_reserve_chunk(chunk))
+        return nullptr;
+    auto frame = chunk.position;
+    // A leftover of 8 bytes cannot hold a padding frame, so the frame swallows it.
+    if (size_t(chunk.end - frame) == (total + 8)) {
+      memset(frame + total, 0, 8);
+      total += 8;
+    }
+    chunk.position += total;
+    // The header goes in before the padding moves on, so the worker never takes the frame for committed padding.
+    auto data = &((new (frame) log_frame_t(total, index, time))->data[0]);
+    log_pad(chunk.position, chunk.end);
+    return data;
+  }
+
+  char* log_frames(uint32_t size, uint32_t index, uint64_t time, size_t& count) {
+    assert(size % 8 == 0);
+    assert(size < 65536);
+    auto& chunk = log_chunk;
+    log_chunk_busy_t busy(chunk);
+    size_t stride = size + sizeof(log_frame_t);
+    if ((size_t(chunk.end - chunk.position) < stride) || (chunk.segment != chunk.target()) ||
+        (time > chunk.deadline)) [[unlikely]]
+      if (!log_reserve_chunk(chunk)) {
+        count = 0;
+        return nullptr;
+      }
+    size_t room = chunk.end - chunk.position;
+    count = std::clamp<size_t>(count, 1, room / stride);
+    // The 8 bytes a padding frame cannot cover are left to log_frame, which swallows them into its frame.
+    if ((room - (count * stride)) == 8) {
+      if (count == 1)
+        return log_frame(size, index, time);
+      count--;
+    }
+    auto first = chunk.position;
+    for (size_t i = 0; i < count; i++)
+      new (first + (i * stride)) log_frame_t(stride, index, time);
+    chunk.position += count * stride;
+    log_pad(chunk.position, chunk.end);
+    return first + sizeof(log_frame_t);
+  }
+
+  bool log_describe(std::string_view text, uint32_t index) {
+    auto& chunk = log_chunk;
+    auto hold = std::exchange(chunk.hold, chunk.segment);
+    auto frame = log_frame((text.size() & ~7ULL) + 8, index, {});
+    chunk.hold = hold;
+    if (!frame)
+      return false;
+    memcpy(frame, text.data(), text.size());
+    log_commit(frame);
+    return true;
+  }
+
+  std::atomic<uint64_t> log_split_keys = 0;
+
+  // Payload bytes of a frame from log_frame, which can be 8 more than asked for. Split pieces fill all of them, since the
+  // readers join pieces by their frame sizes.
+  inline size_t log_frame_capacity(char* data) {
+    auto frame = reinterpret_cast<log_frame_t*>(data - sizeof(log_frame_t));
+    return (frame->size.load(std::memory_order_relaxed) & log_frame_size_mask) - sizeof(log_frame_t);
+  }
+
+  // The chunk stays busy from the head to the last piece, which keep to the head's segment.
+  char* log_split_writer::begin(size_t len, uint32_t index, uint64_t time) {
+    this->time = time;
+    key = log_split_keys.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t first = std::min(len, log_frame_payload_max - sizeof(log_continued_t));
+    auto& chunk = log_chunk;
+    chunk.enter();
+    head = log_frame(first + sizeof(log_continued_t), index, time);
+    if (!head) {
+      chunk.leave();
+      return nullptr;
+    }
+    held = !chunk.hold;
+    chunk.hold = chunk.segment;
+    auto frame = reinterpret_cast<log_frame_t*>(head - sizeof(log_frame_t));
+    frame->size.store(frame->size.load(std::memory_order_relaxed) | log_frame_continued, std::memory_order_relaxed);
+    log_continued_t continued{len, key};
+    memcpy(head, &continued, sizeof(continued));
+    current = head;
+    ptr = head + sizeof(continued);
+    leftover = std::min(len, log_frame_capacity(head) - sizeof(continued));
+    remaining = len - leftover;
+    return head;
+  }
+
+  bool log_split_writer::next() {
+    if (failed)
+      return false;
+    if (current != head)
+      log_commit(current);
+    size_t piece = std::min(remaining, log_frame_payload_max - sizeof(key));
+    current = piece ? log_frame(piece + sizeof(key), log_continuation_index, time) : nullptr;
+    if (!current) {
+      // The head is never completed; as committed padding it no longer keeps its chunk pinned.
+      auto frame = reinterpret_cast<log_frame_t*>(head - sizeof(log_frame_t));
+      frame->index = log_padding_index;
+      frame->size.store((frame->size.load(std::memory_order_relaxed) & log_frame_size_mask) | log_frame_committed,
+                        std::memory_order_release);
+      if (held)
+        log_chunk.hold = nullptr;
+      log_chunk.leave();
+      failed = true;
+      leftover = 0;
+      return false;
+    }
+    memcpy(current, &key, sizeof(key));
+    ptr = current + sizeof(key);
+    leftover = std::min(remaining, log_frame_capacity(current) - sizeof(key));
+    remaining -= leftover;
+    return true;
+  }
+
+  char* log_split_writer::finish() {
+    if (failed)
+      return nullptr;
+    memset(ptr, 0, leftover);
+    // Continuations the arguments came up short of are still written, zeroed, so the head's length holds.
+    while (remaining && next())
+      memset(ptr, 0, leftover);
+    if (failed)
+      return nullptr;
+    if (current != head)
+      log_commit(current);
+    log_commit(head);
+    if (held)
+      log_chunk.hold = nullptr;
+    log_chunk.leave();
+    return head;
+  }
+
+  // Flags hang off every dotted prefix of a message name plus "*". Settings are remembered so that messages registering
+  // late pick up the most specific one that applies to them.
+  struct log_disablers_t {
+    std::mutex mtx;
+    std::map<std::string, std::vector<std::pair<std::string_view, std::atomic<bool>*>>, std::less<>> flags;
+    std::map<std::string, bool, std::less<>> disabled;
+    std::map<std::string, std::vector<log_limiter_t*>, std::less<>> limiters;
+    std::map<std::string, log_limit_t, std::less<>> limits;
+  };
+  log_disablers_t& log_disablers() {
+    static log_disablers_t x;
+    return x;
+  }
+
+  template <typename F> void for_each_log_prefix(std::string_view v, F&& f) {
+    f("*"sv);
     size_t found_pos = 0;
     size_t cur = 0;
     while ((cur = v.find('.', found_pos)) != std::string_view::npos) {
-      disablers[std::string(v.substr(0, cur))].emplace_back(ptr);
+      f(v.substr(0, cur));
       found_pos = cur + 1;
     }
-    disablers[std::string(v)].emplace_back(ptr);
-    disablers["*"].emplace_back(ptr);
+    f(v);
+  }
+  // The setting of the most specific prefix of name that has one.
+  template <typename M> std::optional<typename M::mapped_type> log_setting_for(const M& settings, std::string_view name) {
+    std::optional<typename M::mapped_type> out;
+    for_each_log_prefix(name, [&](std::string_view prefix) {
+      auto found = settings.find(prefix);
+      if (found != settings.end())
+        out = found->second;
+    });
+    return out;
+  }
+
+  void set_log_enabled(std::string_view prefix, bool enabled) {
+    auto& [mtx, flags, disabled, limiters, limits] = log_disablers();
+    std::unique_lock lock(mtx);
+    disabled.insert_or_assign(std::string(prefix), !enabled);
+    // Messages below a more specific setting keep it, as they would when registering after this call.
+    auto it = flags.find(prefix);
+    if (it != flags.end())
+      for (auto [name, d] : it->second)
+        d->store(*log_setting_for(disabled, name), std::memory_order_relaxed);
+  }
+
+  void read_log_disabler() {
+    std::ifstream file("nolog.txt");
+    std::string line;
+    while (std::getline(file, line))
+      set_log_enabled(line, false);
+  }
+
+  // Limits are kept in clock ticks, so they are converted again once init_log has calibrated the clock.
+  void apply_log_limit(log_limiter_t* limiter, const log_limit_t& limit) {
+    uint64_t interval = 0;
+    if (limit.per_second > 0)
+      interval = std::max<uint64_t>(1, uint64_t(double(log_clock.ticks_per_second) / limit.per_second));
+    limiter->sample_every.store(std::max<uint32_t>(limit.sample_every, 1), std::memory_order_relaxed);
+    limiter->interval.store(interval, std::memory_order_relaxed);
+    limiter->tolerance.store(interval * limit.burst, std::memory_order_relaxed);
+    limiter->active.store((limit.sample_every > 1) || interval, std::memory_order_relaxed);
+  }
+
+  void set_log_limit(std::string_view prefix, const log_limit_t& limit) {
+    auto& [mtx, flags, disabled, limiters, limits] = log_disablers();
+    std::unique_lock lock(mtx);
+    limits.insert_or_assign(std::string(prefix), limit);
+    auto it = limiters.find(prefix);
+    if (it != limiters.end())
+      for (auto l : it->second)
+        apply_log_limit(l, *log_setting_for(limits, l->name));
+  }
+
+  void refresh_log_limits() {
+    auto& [mtx, flags, disabled, limiters, limits] = log_disablers();
+    std::unique_lock lock(mtx);
+    auto it = limiters.find("*"sv);
+    if (it == limiters.end())
+      return;
+    for (auto l : it->second)
+      if (auto limit = log_setting_for(limits, l->name))
+        apply_log_limit(l, *limit);
+  }
+
+  // Lines of "prefix sample_every per_second burst".
+  void read_log_limits() {
+    std::ifstream file("loglimit.txt");
+    std::string prefix;
+    log_limit_t limit;
+    while (file >> prefix >> limit.sample_every >> limit.per_second >> limit.burst)
+      set_log_limit(prefix, limit);
+  }
+
+  // Generic cell rate algorithm: tat is the time the bucket drains back to empty, an event fits while that stays within
+  // the burst tolerance of now.
+  bool log_limiter_t::admit_rate() {
+    auto now = log_clock_now();
+    auto step = interval.load(std::memory_order_relaxed);
+    auto limit = tolerance.load(std::memory_order_relaxed) + step;
+    auto t = tat.load(std::memory_order_relaxed);
+    while (true) {
+      auto next = std::max<uint64_t>(t, now) + step;
+      if ((next - now) > limit)
+        return false;
+      if (tat.compare_exchange_weak(t, next, std::memory_order_relaxed))
+        return true;
+    }
+  }
+
+  void add_log_disabler(std::string_view v, std::atomic<bool>* ptr, log_limiter_t* limiter) {
+    auto& [mtx, flags, disabled, limiters, limits] = log_disablers();
+    std::unique_lock lock(mtx);
+    limiter->name = v;
+    for_each_log_prefix(v, [&](std::string_view prefix) {
+      flags[std::string(prefix)].emplace_back(v, ptr);
+      limiters[std::string(prefix)].emplace_back(limiter);
+    });
+    if (auto d = log_setting_for(disabled, v))
+      ptr->store(*d, std::memory_order_relaxed);
+    if (auto limit = log_setting_for(limits, v))
+      apply_log_limit(limiter, *limit);
+  }
+
+  // Writes one frame per message that had events sampled away or rate limited since the last summary.
+  void log_limit_summary() {
+    std::vector<std::pair<std::string_view, uint64_t>> counts;
+    {
+      auto& [mtx, flags, disabled, limiters, limits] = log_disablers();
+      std::unique_lock lock(mtx);
+      auto it = limiters.find("*"sv);
+      if (it == limiters.end())
+        return;
+      for (auto l : it->second)
+        if (auto n = l->suppressed.exchange(0, std::memory_order_relaxed))
+          counts.emplace_back(l->name, n);
+    }
+    for (auto& [name, n] : counts)
+      nie::logger<"nie", "log">{}.info<"suppressed">("message"_log = name, "events"_log = n);
   }
   struct l_hash {
     std::hash<const char*> function_hash;
@@ -125,69 +654,519 @@ namespace nie {
              (a.column() == b.column());
     }
   };
-  void register_capnp(uint64_t s, const nie::function_ref<void()>& cb) {
-    static std::shared_mutex mtx;
-    static std::unordered_set<uint64_t> set = {0xE682AB4CF923A417ULL};
-    {
-      std::shared_lock lock(mtx);
-      if (set.contains(s))
-        return;
+  // Registrations are remembered per log generation, so every segment carries the ones its frames refer to.
+  // Registrations are written before the generation is stored, so two threads racing on a first use may both write one;
+  // the reader keeps either. What they never do is take a lock once a registration is current.
+
+  // Open addressing over schema ids. Slots are claimed with a CAS and never freed; if the table fills up the schema is
+  // simply registered on every use.
+  struct log_id_set_t {
+    struct slot_t {
+      std::atomic<uint64_t> key = 0;
+      std::atomic<uint32_t> generation = 0;
+    };
+    std::array<slot_t, 4096> slots;
+    slot_t* find(uint64_t key) {
+      size_t start = (key * 0x9E3779B97F4A7C15ULL) >> 52;
+      for (size_t i = 0; i < slots.size(); i++) {
+        auto& slot = slots[(start + i) % slots.size()];
+        auto k = slot.key.load(std::memory_order_acquire);
+        if (!k && slot.key.compare_exchange_strong(k, key, std::memory_order_acq_rel))
+          return &slot;
+        if (k == key)
+          return &slot;
+      }
+      return nullptr;
     }
+  };
+  void register_capnp(uint64_t s, const nie::function_ref<void()>& cb) {
+    // The schema of schema.capnp's Node, which the registration itself is logged as.
+    if (!s || (s == 0xE682AB4CF923A417ULL))
+      return;
+    static log_id_set_t ids;
+    auto generation = log_generation.load(std::memory_order_acquire);
+    auto slot = ids.find(s);
+    if (slot && (slot->generation.load(std::memory_order_relaxed) == generation))
+      return;
     cb();
-    std::unique_lock lock(mtx);
-    set.insert(s);
-    return;
+    if (slot)
+      slot->generation.store(generation, std::memory_order_relaxed);
   }
   void register_nie_string(nie::string s) {
-    static std::shared_mutex mtx;
-    static std::unordered_set<nie::string> set;
-    {
-      std::shared_lock lock(mtx);
-      if (set.contains(s))
-        return;
-    }
-    std::unique_lock lock(mtx);
-    if (set.contains(s))
+    auto data = static_cast<nie::string_data const*>(s.ptr());
+    auto generation = log_generation.load(std::memory_order_acquire);
+    if (!data || (data->logged_generation.load(std::memory_order_relaxed) == generation))
       return;
-    nie::logger<>{}.info<"string_cache">("index"_log = size_t(s.ptr()), "data"_log = s());
-    set.insert(s);
-    return;
+    nie::logger<>{}.registration<"string_cache">("index"_log = size_t(s.ptr()), "data"_log = s());
+    data->logged_generation.store(generation, std::memory_order_relaxed);
+  }
+
+  // Chained hash of every source_location seen so far. Entries are pushed onto the front of a bucket with a CAS and
+  // live forever; only the text used by the text echo sits behind a mutex, and it is only written on first use.
+  struct source_locations_t {
+    struct entry {
+      std::source_location location;
+      uint32_t index;
+      std::atomic<uint32_t> generation;
+      entry* next;
+    };
+    static constexpr size_t buckets = 4096;
+    std::atomic<uint32_t> ctr = 0;
+    std::array<std::atomic<entry*>, buckets> map = {};
+    std::shared_mutex mtx;
+    std::unordered_map<uint32_t, std::string> text;
+  };
+  source_locations_t& source_locations() {
+    static source_locations_t x;
+    return x;
+  }
+  inline void log_source_location(uint32_t idx, std::source_location l) {
+    std::string_view funcn = l.function_name();
+    nie::logger<>{}.registration<"source_location">(
+        "index"_log = idx, "function_name"_log = funcn, "file_name"_log = l.file_name(), "line"_log = l.line());
   }
   uint32_t lookup_source_location(std::source_location l) {
-    static std::atomic<uint32_t> ctr = 0;
-    static std::shared_mutex mtx;
-    static std::unordered_map<std::source_location, uint32_t, l_hash, l_equal> map;
+    auto& [ctr, map, mtx, text] = source_locations();
+    auto generation = log_generation.load(std::memory_order_acquire);
+    auto& bucket = map[l_hash{}(l) % source_locations_t::buckets];
+    auto head = bucket.load(std::memory_order_acquire);
+    for (auto e = head; e; e = e->next)
+      if (l_equal{}(e->location, l)) {
+        if (e->generation.load(std::memory_order_relaxed) != generation) [[unlikely]] {
+          log_source_location(e->index, l);
+          e->generation.store(generation, std::memory_order_relaxed);
+        }
+        return e->index;
+      }
+    auto e = new source_locations_t::entry{l, ctr++, 0, head};
+    while (!bucket.compare_exchange_weak(e->next, e, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      // Someone else pushed first; they may have added the same location.
+      for (auto o = e->next; o != head; o = o->next)
+        if (l_equal{}(o->location, l)) {
+          delete e;
+          return lookup_source_location(l);
+        }
+      head = e->next;
+    }
     {
-      std::shared_lock lock(mtx);
-      if (map.contains(l))
-        return map.at(l);
+      std::unique_lock lock(mtx);
+      text.emplace(e->index, std::format("{}", l));
     }
-    auto idx = ctr++;
-    std::string_view funcn = l.function_name();
-    nie::logger<>{}.info<"source_location">(
-        "index"_log = idx, "function_name"_log = funcn, "file_name"_log = l.file_name(), "line"_log = l.line());
-    std::unique_lock lock(mtx);
-    if (map.contains(l))
-      return map.at(l);
-    map.emplace(l, idx);
-    return idx;
+    log_source_location(e->index, l);
+    e->generation.store(generation, std::memory_order_relaxed);
+    return e->index;
   }
-  void init_log() {
-#if defined(_WIN32)
-#else
-    assert(!nie::log::nie_log_buffer_output);
-    int fd = open((executable_name() + std::string(".nielog")).data(), O_RDWR | O_CLOEXEC | O_CREAT | O_TRUNC, 0666);
+
+  // Text echo. Callers only queue the binary payload (or an already rendered line); a single consumer thread turns it into
+  // text with the offline decoder and batches the console and .txt writes.
+  struct text_event_t {
+    enum class target_e { both, file, stop };
+    target_e target = target_e::both;
+    std::string_view descriptor;
+    uint64_t time = 0;
+    size_t frame = 0;
+    std::string data;
+  };
+  thread_local bool on_text_sink = false;
+
+  struct text_sink_t final : nie::log_reader::resolver_t {
+    moodycamel::ConcurrentQueue<text_event_t> queue;
+    std::atomic<uint64_t> enqueued = 0;
+    std::atomic<uint64_t> rendered = 0;
+    std::unordered_map<const char*, std::optional<nie::log_reader::descriptor_t>> descriptors;
+    std::ofstream file;
+    std::jthread thread;
+
+    inline text_sink_t()
+        : file(executable_name() + std::string(".txt"), std::ofstream::out | std::ofstream::trunc), thread([this] { run(); }) {}
+    inline ~text_sink_t() {
+      push(text_event_t{text_event_t::target_e::stop});
+      thread.join();
+    }
+    inline void push(text_event_t&& e) {
+      queue.enqueue(std::move(e));
+      enqueued.fetch_add(1);
+      enqueued.notify_one();
+    }
+    void flush() {
+      if (on_text_sink)
+        return;
+      auto target = enqueued.load();
+      for (auto r = rendered.load(); r < target; r = rendered.load())
+        rendered.wait(r);
+    }
+
+    std::optional<std::string_view> string(uint64_t p) const override {
+      return p ? reinterpret_cast<nie::string_data const*>(p)->text() : ""sv;
+    }
+    std::optional<std::string_view> source_location(uint32_t index) const override {
+      auto& locations = source_locations();
+      std::shared_lock lock(locations.mtx);
+      auto it = locations.text.find(index);
+      if (it == locations.text.end())
+        return std::nullopt;
+      return it->second;
+    }
+
+    void render(std::string& console, std::string& text, text_event_t& e) {
+      if (e.descriptor.empty()) {
+        if (e.target == text_event_t::target_e::both)
+          (console += e.data) += '\n';
+        (text += e.data) += '\n';
+        return;
+      }
+      auto [it, inserted] = descriptors.try_emplace(e.descriptor.data());
+      if (inserted)
+        it->second = nie::log_reader::parse_descriptor(e.descriptor);
+      auto& d = it->second;
+      auto start = text.size();
+      if (!d) {
+        text += std::format("[{} {:#x}] ????", log_clock_time(e.time), e.frame);
+      } else {
+        text += std::format("[{} {:#x}] {} {}: ", log_clock_time(e.time), e.frame, nie::levstr(d->level), d->message);
+        nie::log_reader::format_text(text, *d, e.data, this, e.frame);
+      }
+      text += '\n';
+      console.append(text, start);
+    }
+
+    void run() {
+      on_text_sink = true;
+      std::string console, text;
+      text_event_t e;
+      uint64_t done = 0;
+      bool stop = false;
+      while (true) {
+        auto seen = enqueued.load();
+        while (queue.try_dequeue(e)) {
+          done++;
+          if (e.target == text_event_t::target_e::stop)
+            stop = true;
+          else
+            render(console, text, e);
+          if ((console.size() + text.size()) >= 65536)
+            write(console, text);
+        }
+        write(console, text);
+        rendered.store(done);
+        rendered.notify_all();
+        if (done == seen) {
+          if (stop)
+            return;
+          enqueued.wait(seen);
+        }
+      }
+    }
+
+    void write(std::string& console, std::string& text) {
+      if (!console.empty()) {
+        std::cout.write(console.data(), console.size());
+        std::cout.flush();
+        console.clear();
+      }
+      if (!text.empty()) {
+        file.write(text.data(), text.size());
+        file.flush();
+        text.clear();
+      }
+    }
+  };
+  text_sink_t& text_sink() {
+    static text_sink_t x;
+    return x;
+  }
+
+  void log_text(std::string_view descriptor, uint64_t time, const void* frame, std::span<const char> payload) {
+    text_sink().push(
+        text_event_t{text_event_t::target_e::both, descriptor, time, size_t(frame), std::string(payload.data(), payload.size())});
+  }
+  void log_text(std::string line) {
+    text_sink().push(text_event_t{text_event_t::target_e::both, {}, {}, 0, std::move(line)});
+  }
+  void log_text_flush() {
+    text_sink().flush();
+  }
+  void write_log_file(std::string_view m) {
+    text_sink().push(text_event_t{text_event_t::target_e::file, {}, {}, 0, std::string(m)});
+  }
+  char* log_scratch() {
+    alignas(8) thread_local char scratch[65536];
+    return scratch;
+  }
+
+#if !defined(_WIN32)
+  std::string log_tap_name() {
+    return "/nielog." + executable_name() + "." + std::to_string(getpid());
+  }
+
+  nie::log_tap_t* log_open_tap() {
+    auto name = log_tap_name();
+    int fd = shm_open(name.data(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+      perror("Log Tap Open");
+      return nullptr;
+    }
+    auto size = std::bit_ceil(std::max<size_t>(log_tap_size, 65536 + sizeof(log_frame_t)));
+    if (ftruncate(fd, sizeof(nie::log_tap_t) + size)) {
+      perror("Log Tap Truncate");
+      close(fd);
+      shm_unlink(name.data());
+      return nullptr;
+    }
+    auto ptr = mmap(nullptr, sizeof(nie::log_tap_t) + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      perror("Log Tap Map");
+      shm_unlink(name.data());
+      return nullptr;
+    }
+    auto tap = new (ptr) nie::log_tap_t;
+    tap->size = size;
+    tap->clock = log_clock;
+    tap->signature = log_tap_signature;
+    std::atexit([] { shm_unlink(log_tap_name().data()); });
+    return tap;
+  }
+
+  // Mirrors the collector's attached pid into log_tap_attached. A new collector gets every descriptor and registration
+  // again through a generation bump, one that died without detaching is noticed by its pid going away.
+  void log_tap_poll() {
+    if (!log_tap)
+      return;
+    auto pid = log_tap->attached.load(std::memory_order_acquire);
+    bool live = pid && ((kill(pid_t(pid), 0) == 0) || (errno == EPERM));
+    if (pid && !live)
+      log_tap->attached.compare_exchange_strong(pid, 0);
+    if (live == log_tap_attached.load(std::memory_order_relaxed))
+      return;
+    log_tap_attached.store(live, std::memory_order_relaxed);
+    if (live)
+      log_generation.fetch_add(1, std::memory_order_release);
+  }
+
+  std::string log_segment_name(uint64_t number) {
+    return executable_name() + "." + std::to_string(number) + ".nielog";
+  }
+
+  // The GNU build id note of the executable, the first object dl_iterate_phdr reports.
+  std::string log_build_id() {
+    std::string id;
+    dl_iterate_phdr(
+        [](dl_phdr_info* info, size_t, void* out) {
+          for (size_t i = 0; i < info->dlpi_phnum; i++) {
+            auto& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_NOTE)
+              continue;
+            size_t align = (phdr.p_align == 8) ? 8 : 4;
+            auto p = reinterpret_cast<const char*>(info->dlpi_addr + phdr.p_vaddr);
+            auto end = p + phdr.p_memsz;
+            while ((p + sizeof(ElfW(Nhdr))) <= end) {
+              auto note = reinterpret_cast<const ElfW(Nhdr)*>(p);
+              auto name = p + sizeof(ElfW(Nhdr));
+              auto desc = name + ((note->n_namesz + align - 1) & ~(align - 1));
+              if ((note->n_type == NT_GNU_BUILD_ID) && (note->n_namesz == 4) && !memcmp(name, "GNU", 4)) {
+                static_cast<std::string*>(out)->assign(desc, note->n_descsz);
+                return 1;
+              }
+              p = desc + ((note->n_descsz + align - 1) & ~(align - 1));
+            }
+          }
+          return 1;
+        },
+        &id);
+    return id;
+  }
+
+  nie::log::log_segment_t* log_open_segment(std::string const& name, uint64_t number, size_t size) {
+    int fd = open(name.data(), O_RDWR | O_CLOEXEC | O_CREAT | O_TRUNC, 0666);
     if (fd == -1) {
       perror("Log File Open");
-      abort();
+      return nullptr;
     }
-    if (ftruncate(fd, 2147483648ULL)) {
+    if (ftruncate(fd, size)) {
       perror("Log File Truncate");
-      abort();
+      close(fd);
+      return nullptr;
+    }
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      perror("Log File Map");
+      close(fd);
+      return nullptr;
+    }
+    auto segment = new nie::log::log_segment_t;
+    segment->buffer = new (ptr) nie::log_buffer_t;
+    segment->buffer->clock = log_clock;
+    segment->buffer->chunk_age = log_chunk_age;
+    segment->buffer->chunk_size = log_chunk_size;
+    segment->buffer->start_time = log_clock.tai(log_clock_now());
+    static const auto build_id = log_build_id();
+    segment->buffer->build_id_size = std::min(build_id.size(), sizeof(segment->buffer->build_id));
+    memcpy(segment->buffer->build_id, build_id.data(), segment->buffer->build_id_size);
+    segment->buffer->signature = log_signature;
+    segment->size = size;
+    segment->fd = fd;
+    segment->number = number;
+    return segment;
+  }
+
+  // Finished segments are compressed on their own thread, since that takes far longer than the worker may stall.
+  std::mutex log_compress_mutex;
+  std::condition_variable log_compress_cv;
+  std::deque<uint64_t> log_compress_queue;
+
+  void log_compressor() {
+    std::unique_lock lock(log_compress_mutex);
+    while (true) {
+      log_compress_cv.wait(lock, [] { return !log_compress_queue.empty(); });
+      auto number = log_compress_queue.front();
+      log_compress_queue.pop_front();
+      lock.unlock();
+      auto name = log_segment_name(number);
+      auto codec = nie::log_codec_e(std::min<uint32_t>(log_compress_codec, 1));
+      if (nie::log_reader::compress_file(name, name + "z", codec, log_compress_level, 1)) {
+        // log.segment_keep may have retired the segment meanwhile.
+        if (unlink(name.data()))
+          unlink((name + "z").data());
+      } else
+        nie::logger<"nie", "log">{}.warn<"compress_failed">("segment"_log = number);
+      lock.lock();
+    }
+  }
+
+  std::mutex log_worker_mutex;
+  std::condition_variable log_worker_cv;
+
+  void log_worker_wake() {
+    log_worker_cv.notify_one();
+  }
+
+  // Whether the worker may take back pins, see log_revoke_chunks.
+  bool log_membarrier = false;
+
+  // Takes back the pins of chunks in superseded segments once all their frames are committed, sealing them first if
+  // log.checksum is on, so that a thread which stopped logging keeps no segment mapped. The membarrier pairs with
+  // log_chunk_busy_t: an owner that was past its segment check before it is seen busy or has its header in place, and
+  // one that gets there after it sees the new segment and leaves for its slow path, which waits on mtx.
+  void log_revoke_chunks(nie::log::log_segment_t* current) {
+    if (!log_membarrier || syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0))
+      return;
+    auto stale = [&](nie::log::log_segment_t* segment) {
+      return segment->number < current->number;
+    };
+    auto& registry = log_chunks();
+    std::lock_guard lock(registry.mtx);
+    for (auto chunk : registry.chunks) {
+      std::lock_guard chunk_lock(chunk->mtx);
+      if (chunk->segment && !chunk->revoked && stale(chunk->segment) && !chunk->busy.load(std::memory_order_acquire) &&
+          log_settle(chunk->begin, chunk->end)) {
+        chunk->revoked = true;
+        chunk->segment->users.fetch_sub(1);
+      }
+      std::erase_if(chunk->pending, [&](const log_chunk_t::pending_t& p) {
+        if (!stale(p.segment) || !log_settle(p.begin, p.end))
+          return false;
+        p.segment->users.fetch_sub(1);
+        return true;
+      });
+    }
+  }
+
+  // Prepares the next segment ahead of time and retires old ones once no chunk refers to them any more, each on its own.
+  // Also reports dropped frames and suppressed events and watches the live tap.
+  void log_worker() {
+    std::deque<nie::log::log_segment_t*> mapped = {nie::log::current_segment.load()};
+    std::set<uint64_t> finished;
+    uint64_t reported_drops = 0;
+    auto summarised = std::chrono::steady_clock::now();
+    std::unique_lock lock(log_worker_mutex);
+    while (true) {
+      auto current = nie::log::current_segment.load();
+      if (nie::log::segmented && !current->next.load()) {
+        auto next = log_open_segment(log_segment_name(current->number + 1), current->number + 1, log_segment_size);
+        if (next) {
+          current->next.store(next);
+          mapped.push_back(next);
+        }
+      }
+      bool pinned = false;
+      for (auto segment : mapped)
+        pinned = pinned || ((segment->number < current->number) && (segment->users.load() != 0));
+      if (pinned)
+        log_revoke_chunks(current);
+      std::erase_if(mapped, [&](nie::log::log_segment_t* segment) {
+        // The segment prepared ahead of current is not in use yet either.
+        if ((segment->number >= current->number) || (segment->users.load() != 0))
+          return false;
+        msync(segment->buffer, segment->size, MS_SYNC);
+        munmap(segment->buffer, segment->size);
+        close(segment->fd);
+        segment->buffer = nullptr;
+        finished.insert(segment->number);
+        if (log_compress_codec) {
+          std::unique_lock compress_lock(log_compress_mutex);
+          log_compress_queue.push_back(segment->number);
+          log_compress_cv.notify_one();
+        }
+        while (log_segment_keep() && (finished.size() > log_segment_keep())) {
+          auto name = log_segment_name(*finished.begin());
+          unlink(name.data());
+          unlink((name + "z").data());
+          finished.erase(finished.begin());
+        }
+        return true;
+      });
+      auto drops = nie::log::dropped_frames.load(std::memory_order_relaxed);
+      if (drops != reported_drops) {
+        lock.unlock();
+        nie::logger<"nie", "log">{}.warn<"dropped">("frames"_log = uint64_t(drops - reported_drops));
+        lock.lock();
+        reported_drops = drops;
+      }
+      log_tap_poll();
+      if ((std::chrono::steady_clock::now() - summarised) >= std::chrono::seconds(log_limit_summary_interval)) {
+        lock.unlock();
+        log_limit_summary();
+        lock.lock();
+        summarised = std::chrono::steady_clock::now();
+      }
+      log_worker_cv.wait_for(lock, 100ms);
+    }
+  }
+#else
+  void log_worker_wake() {}
+#endif
+
+  void init_log() {
+#if defined(_WIN32)
+#else
+    assert(!nie::log::current_segment.load());
+    log_clock = log_calibrate_clock(nie::log_clock_e(std::min<uint32_t>(log_clock_source, 2)));
+    log_chunk_age = log_chunk_max_age() * log_clock.ticks_per_second;
+    log_seal_chunks = log_checksum;
+    // Without it idle threads keep their last segment mapped until they exit.
+    log_membarrier = !syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0);
+    read_log_disabler();
+    read_log_limits();
+    refresh_log_limits();
+    if (log_tap_enabled)
+      log_tap = log_open_tap();
+    nie::log::segmented = log_segmented;
+    if (nie::log::segmented) {
+      nie::require(log_segment_size() >= (2 * log_chunk_size), "log.segment_size is smaller than two chunks"sv);
+      auto segment = log_open_segment(log_segment_name(0), 0, log_segment_size);
+      if (!segment)
+        abort();
+      nie::log::current_segment.store(segment);
+      if (log_compress_codec)
+        std::thread(log_compressor).detach();
+    } else {
+      auto segment = log_open_segment(executable_name() + std::string(".nielog"), 0, log_buffer_size);
+      if (!segment)
+        abort();
+      nie::log::current_segment.store(segment);
     }
-    auto ptr = mmap(nullptr, 2147483648ULL, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    nie::log::nie_log_buffer_output = new (ptr) nie::log::nie_log_buffer_t;
-    nie::log::nie_log_buffer_output->signature = 724313520984115534ULL;
+    std::thread(log_worker).detach();
 #endif
   }
 } // namespace nie
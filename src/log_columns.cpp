@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <nie/log_reader.hpp>
+#include <set>
+
+namespace nie::log_reader {
+  using namespace std::literals;
+
+  namespace {
+    size_t fixed_width(std::string_view type) {
+      if ((type == "boolean") || (type == "uint8") || (type == "int8"))
+        return 1;
+      if ((type == "uint16") || (type == "int16"))
+        return 2;
+      if ((type == "uint32") || (type == "int32") || (type == "source_location") || (type == "cookie"))
+        return 4;
+      if ((type == "uint64") || (type == "int64") || (type == "pointer") || (type == "cached_string") || (type == "node_handle"))
+        return 8;
+      return 0;
+    }
+
+    std::string quoted(std::string_view text) {
+      std::string out = "\"";
+      for (char c : text) {
+        if ((c == '"') || (c == '\\'))
+          out += '\\';
+        out += c;
+      }
+      return out + '"';
+    }
+
+    // Appends in batches, so memory stays bounded however long the log is and no more than one file is open at a time.
+    struct column_file_t {
+      std::filesystem::path path;
+      std::string buffer;
+      bool failed = false;
+
+      void create(std::filesystem::path p) {
+        path = std::move(p);
+        failed = !std::ofstream(path, std::ios::binary | std::ios::trunc);
+      }
+      void put(std::string_view bytes) {
+        buffer += bytes;
+        if (buffer.size() >= 1048576)
+          flush();
+      }
+      template <typename T> void put(const T& v) {
+        put(std::string_view(reinterpret_cast<const char*>(&v), sizeof(T)));
+      }
+      void flush() {
+        if (buffer.empty())
+          return;
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.write(buffer.data(), buffer.size());
+        failed |= !out;
+        buffer.clear();
+      }
+    };
+
+    struct column_t {
+      const field_t* field;
+      size_t width;
+      std::string file;
+      // The values of fixed-width fields, the running end offsets of variable ones.
+      column_file_t values;
+      column_file_t data;
+      column_file_t schema;
+      uint64_t offset = 0;
+    };
+
+    struct table_t {
+      const descriptor_t* descriptor;
+      std::filesystem::path directory;
+      column_file_t time;
+      std::vector<column_t> columns;
+      uint64_t rows = 0;
+
+      table_t(const std::filesystem::path& root, const descriptor_t& d) : descriptor(&d) {
+        auto name = std::format("{}.{:x}", d.message, d.index);
+        std::replace(name.begin(), name.end(), '/', '_');
+        directory = root / name;
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        time.create(directory / "@time.uint64");
+        std::set<std::string> used;
+        columns.reserve(d.fields.size());
+        for (auto& field : d.fields) {
+          auto& c = columns.emplace_back(column_t{&field, fixed_width(field.type)});
+          c.file = std::string(field.name);
+          if (!used.insert(c.file).second)
+            c.file = std::format("{}.{}", field.name, columns.size() - 1);
+          if (c.width) {
+            c.values.create(directory / std::format("{}.{}", c.file, field.type));
+            continue;
+          }
+          c.values.create(directory / (c.file + ".offsets"));
+          c.values.put(uint64_t(0));
+          c.data.create(directory / (c.file + ".data"));
+          if (field.type == "capnp")
+            c.schema.create(directory / (c.file + ".schema"));
+        }
+      }
+
+      void add(uint64_t t, std::span<const value_t> values) {
+        time.put(t);
+        for (size_t i = 0; i < columns.size(); i++) {
+          auto& c = columns[i];
+          auto& v = values[i];
+          if (c.width) {
+            // Little-endian, so the low bytes of the widened value are the original field.
+            c.values.put(std::string_view(reinterpret_cast<const char*>(&v.number), c.width));
+            continue;
+          }
+          if (v.kind == value_t::kind_e::capnp)
+            c.schema.put(v.number);
+          c.data.put(v.bytes);
+          c.offset += v.bytes.size();
+          c.values.put(c.offset);
+        }
+        rows++;
+      }
+
+      bool finish() {
+        bool failed = false;
+        auto done = [&](column_file_t& f) {
+          f.flush();
+          failed |= f.failed;
+        };
+        done(time);
+        std::string schema = std::format("{{\"message\":{},\"level\":\"{}\",\"index\":{},\"rows\":{},\"columns\":[",
+            quoted(descriptor->message),
+            nie::levstr(descriptor->level),
+            descriptor->index,
+            rows);
+        for (auto& c : columns) {
+          done(c.values);
+          if (!c.width) {
+            done(c.data);
+            if (!c.schema.path.empty())
+              done(c.schema);
+          }
+          schema += std::format("{}{{\"name\":{},\"type\":\"{}\",\"file\":{}}}",
+              (&c == columns.data()) ? "" : ",",
+              quoted(c.field->name),
+              c.field->type,
+              quoted(c.file));
+        }
+        schema += "]}\n";
+        std::ofstream out(directory / "schema.json", std::ios::trunc);
+        out << schema;
+        return !failed && out;
+      }
+    };
+
+    // ids as uint64 next to the usual offsets and data pair.
+    template <typename T, typename F> bool write_dictionary(const std::filesystem::path& base, const std::set<T>& ids, F&& resolve) {
+      column_file_t id_file, offsets, data;
+      id_file.create(base.string() + ".ids");
+      offsets.create(base.string() + ".offsets");
+      data.create(base.string() + ".data");
+      uint64_t offset = 0;
+      offsets.put(offset);
+      for (auto id : ids) {
+        auto text = resolve(id);
+        if (!text)
+          continue;
+        id_file.put(uint64_t(id));
+        data.put(*text);
+        offset += text->size();
+        offsets.put(offset);
+      }
+      id_file.flush();
+      offsets.flush();
+      data.flush();
+      return !(id_file.failed || offsets.failed || data.failed);
+    }
+  } // namespace
+
+  nie::errorable<size_t> export_columns(const file_t& file, std::span<const entry_t> entries, const std::string& directory) {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+      return std::unexpected(ec);
+    std::unordered_map<uint32_t, std::unique_ptr<table_t>> tables;
+    std::set<uint64_t> strings;
+    std::set<uint32_t> locations;
+    std::vector<value_t> values;
+    size_t rows = 0;
+    for (auto& e : entries) {
+      auto d = file.descriptor(e.index);
+      if (!d)
+        continue;
+      // Decoded into a staging row first, so a frame that fails halfway leaves every column the same length.
+      values.clear();
+      if (!visit_fields(*d, file.payload(e), [&](const field_t&, const value_t& v) { values.push_back(v); }))
+        continue;
+      auto& table = tables[e.index];
+      if (!table)
+        table = std::make_unique<table_t>(directory, *d);
+      table->add(e.time, values);
+      for (auto& v : values)
+        if ((v.kind == value_t::kind_e::cached_string) && v.number)
+          strings.insert(v.number);
+        else if (v.kind == value_t::kind_e::source_location)
+          locations.insert(uint32_t(v.number));
+      rows++;
+    }
+    bool good = true;
+    for (auto& [index, table] : tables)
+      good &= table->finish();
+    good &= write_dictionary(std::filesystem::path(directory) / "strings", strings, [&](uint64_t id) { return file.string(id); });
+    good &= write_dictionary(
+        std::filesystem::path(directory) / "locations", locations, [&](uint32_t id) { return file.source_location(id); });
+    if (!good)
+      return std::unexpected(std::make_error_code(std::errc::io_error));
+    return rows;
+  }
+} // namespace nie::log_reader
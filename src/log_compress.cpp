@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <bzlib.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <nie/log_reader.hpp>
+#include <thread>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nie::log_reader {
+  bool compress_block(nie::log_codec_e codec, int level, std::span<const char> in, std::string& out) {
+    switch (codec) {
+    case nie::log_codec_e::none:
+      out.assign(in.data(), in.size());
+      return true;
+    case nie::log_codec_e::bzip2: {
+      unsigned int size = in.size() + (in.size() / 100) + 601;
+      out.resize(size);
+      if (BZ2_bzBuffToBuffCompress(out.data(), &size, const_cast<char*>(in.data()), in.size(), std::clamp(level, 1, 9), 0, 0) != BZ_OK)
+        return false;
+      out.resize(size);
+      return true;
+    }
+    }
+    return false;
+  }
+
+  bool inflate_block(nie::log_codec_e codec, std::span<const char> in, std::span<char> out) {
+    switch (codec) {
+    case nie::log_codec_e::none:
+      if (in.size() != out.size())
+        return false;
+      memcpy(out.data(), in.data(), in.size());
+      return true;
+    case nie::log_codec_e::bzip2: {
+      unsigned int size = out.size();
+      return (BZ2_bzBuffToBuffDecompress(out.data(), &size, const_cast<char*>(in.data()), in.size(), 0, 0) == BZ_OK) &&
+             (size == out.size());
+    }
+    }
+    return false;
+  }
+
+  nie::errorable<size_t> compress_file(const std::string& path, const std::string& out, nie::log_codec_e codec, int level, size_t threads) {
+#if defined(_WIN32)
+    return std::unexpected(std::make_error_code(std::errc::not_supported));
+#else
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    struct stat st;
+    if (fstat(fd, &st) || (size_t(st.st_size) < sizeof(nie::log_buffer_t))) {
+      auto ec = errno ? std::error_code(errno, std::system_category()) : std::make_error_code(std::errc::invalid_argument);
+      close(fd);
+      return std::unexpected(ec);
+    }
+    auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    auto data = static_cast<const char*>(ptr);
+    auto header = reinterpret_cast<const nie::log_buffer_t*>(ptr);
+    if (header->signature != nie::log_signature) {
+      munmap(ptr, st.st_size);
+      return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    }
+    madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+
+    nie::log_compressed_t compressed = {};
+    compressed.codec = codec;
+    compressed.content_length = std::clamp<size_t>(header->content_length.load(), nie::log_data_start, st.st_size);
+    compressed.blocks = (compressed.content_length - nie::log_data_start + nie::log_block_size - 1) / nie::log_block_size;
+    memcpy(compressed.header, data, sizeof(compressed.header));
+
+    // Blocks are compressed by several threads but written in order, a few at a time so memory stays bounded.
+    if (!threads)
+      threads = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<std::string> batch(threads);
+    std::vector<nie::log_block_t> index;
+    auto tmp = out + ".tmp";
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&compressed), sizeof(compressed));
+    uint64_t offset = sizeof(compressed);
+    bool good = bool(file);
+    for (size_t first = 0; good && (first < compressed.blocks); first += threads) {
+      size_t count = std::min<size_t>(threads, compressed.blocks - first);
+      std::vector<char> ok(count);
+      {
+        std::vector<std::jthread> workers;
+        for (size_t i = 0; i < count; i++)
+          workers.emplace_back([&, i] {
+            size_t begin = nie::log_data_start + ((first + i) * nie::log_block_size);
+            size_t end = std::min<size_t>(begin + nie::log_block_size, compressed.content_length);
+            ok[i] = compress_block(codec, level, std::span<const char>(data + begin, end - begin), batch[i]);
+          });
+      }
+      for (size_t i = 0; good && (i < count); i++) {
+        good = ok[i] && file.write(batch[i].data(), batch[i].size());
+        index.push_back(nie::log_block_t{offset, batch[i].size()});
+        offset += batch[i].size();
+      }
+    }
+    munmap(ptr, st.st_size);
+    compressed.index_offset = offset;
+    compressed.signature = nie::log_compressed_signature;
+    if (good) {
+      file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(nie::log_block_t));
+      file.seekp(0);
+      file.write(reinterpret_cast<const char*>(&compressed), sizeof(compressed));
+      file.close();
+      good = bool(file);
+    }
+    if (!good || std::rename(tmp.data(), out.data())) {
+      unlink(tmp.data());
+      return std::unexpected(std::make_error_code(std::errc::io_error));
+    }
+    return offset + (index.size() * sizeof(nie::log_block_t));
+#endif
+  }
+} // namespace nie::log_reader
@@ -0,0 +1,52 @@
+#include <array>
+#include <cstring>
+#include <nie/log_format.hpp>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace nie {
+  namespace {
+    constexpr auto crc32c_table = [] {
+      std::array<uint32_t, 256> table{};
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++)
+          c = (c & 1) ? ((c >> 1) ^ 0x82F63B78U) : (c >> 1);
+        table[i] = c;
+      }
+      return table;
+    }();
+
+    uint32_t crc32c_portable(uint32_t crc, const unsigned char* p, size_t n) {
+      while (n--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+      return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t n) {
+      uint64_t c = crc;
+      for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+      }
+      crc = uint32_t(c);
+      while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+      return crc;
+    }
+    const bool crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+  } // namespace
+
+  uint32_t log_crc32c(uint32_t crc, const void* data, size_t size) {
+    auto p = static_cast<const unsigned char*>(data);
+#if defined(__x86_64__)
+    if (crc32c_hardware)
+      return ~crc32c_sse42(~crc, p, size);
+#endif
+    return ~crc32c_portable(~crc, p, size);
+  }
+} // namespace nie
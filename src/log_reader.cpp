@@ -0,0 +1,914 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <mutex>
+#include <nie/log_reader.hpp>
+#include <thread>
+#include <unordered_set>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nie::log_reader {
+  using namespace std::literals;
+
+  namespace {
+    struct frame_header_t {
+      uint64_t time;
+      uint32_t size;
+      uint32_t index;
+    };
+    static_assert(sizeof(frame_header_t) == sizeof(nie::log_frame_t));
+
+    // Walks the committed frames of one chunk. A frame header that is zero or does not fit means the rest of the chunk was
+    // never written, so the walk stops there; the next chunk starts on a frame boundary again. Frames a crash interrupted
+    // keep their size and are stepped over.
+    template <typename F> void walk_chunk(const char* data, size_t begin, size_t end, F&& f) {
+      size_t pos = begin;
+      while ((pos + sizeof(frame_header_t)) <= end) {
+        frame_header_t header;
+        memcpy(&header, data + pos, sizeof(header));
+        bool committed = header.size & nie::log_frame_committed;
+        header.size &= nie::log_frame_size_mask;
+        if ((header.size < sizeof(frame_header_t)) || (header.size % 8) || ((pos + header.size) > end))
+          return;
+        if (committed && (header.index != nie::log_padding_index) && (header.index != nie::log_seal_index))
+          f(pos, header);
+        pos += header.size;
+      }
+    }
+
+    bool parse_number(std::string_view& text, size_t& out) {
+      auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+      if ((ec != std::errc()) || (ptr == (text.data() + text.size())) || (*ptr != ':'))
+        return false;
+      text.remove_prefix(ptr - text.data() + 1);
+      return true;
+    }
+
+    void append_escaped(std::string& out, std::string_view text) {
+      out += '"';
+      for (char c : text) {
+        switch (c) {
+        case '"':
+          out += "\\\"";
+          break;
+        case '\\':
+          out += "\\\\";
+          break;
+        case '\n':
+          out += "\\n";
+          break;
+        case '\r':
+          out += "\\r";
+          break;
+        case '\t':
+          out += "\\t";
+          break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20)
+            out += std::format("\\u{:04x}", unsigned(c));
+          else
+            out += c;
+        }
+      }
+      out += '"';
+    }
+
+    void append_hex(std::string& out, std::string_view bytes) {
+      for (unsigned char c : bytes)
+        out += std::format("{:02x}", unsigned(c));
+    }
+  } // namespace
+
+  std::optional<descriptor_t> parse_descriptor(std::string_view text) {
+    descriptor_t d;
+    if (!text.starts_with("0:"))
+      return std::nullopt;
+    text.remove_prefix(2);
+    size_t level, len;
+    if (!parse_number(text, level) || (level > size_t(nie::level_e::internal)))
+      return std::nullopt;
+    d.level = nie::level_e(level);
+    if (!parse_number(text, len) || (text.size() < len))
+      return std::nullopt;
+    d.message = text.substr(0, len);
+    text.remove_prefix(len);
+    while (text.starts_with(":A:")) {
+      text.remove_prefix(3);
+      auto colon = text.find(':');
+      if (colon == std::string_view::npos)
+        return std::nullopt;
+      field_t field;
+      field.type = text.substr(0, colon);
+      text.remove_prefix(colon + 1);
+      if (!parse_number(text, len) || (text.size() < len))
+        return std::nullopt;
+      field.name = text.substr(0, len);
+      text.remove_prefix(len);
+      d.fields.push_back(field);
+    }
+    if (!text.starts_with("::"))
+      return std::nullopt;
+    return d;
+  }
+
+  bool visit_fields(const descriptor_t& d, std::span<const char> payload, const nie::function_ref<void(const field_t&, const value_t&)>& cb) {
+    size_t pos = 0;
+    auto take = [&](size_t n, std::string_view& out) {
+      if ((payload.size() - pos) < n)
+        return false;
+      out = std::string_view(payload.data() + pos, n);
+      pos += n;
+      return true;
+    };
+    auto integer = [&]<typename T>(T& out) {
+      std::string_view bytes;
+      if (!take(sizeof(T), bytes))
+        return false;
+      memcpy(&out, bytes.data(), sizeof(T));
+      return true;
+    };
+    auto sized = [&](std::string_view& out) {
+      uint32_t n;
+      return integer(n) && take(n, out);
+    };
+    for (auto& field : d.fields) {
+      using enum value_t::kind_e;
+      value_t v{unsigned_integer};
+      auto& t = field.type;
+      if ((t == "boolean") || (t == "uint8")) {
+        uint8_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{(t == "boolean") ? boolean : unsigned_integer, n};
+      } else if (t == "int8") {
+        int8_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{signed_integer, uint64_t(int64_t(n))};
+      } else if (t == "uint16") {
+        uint16_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{unsigned_integer, n};
+      } else if (t == "int16") {
+        int16_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{signed_integer, uint64_t(int64_t(n))};
+      } else if ((t == "uint32") || (t == "source_location") || (t == "cookie")) {
+        uint32_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{(t == "uint32") ? unsigned_integer : ((t == "cookie") ? cookie : source_location), n};
+      } else if (t == "int32") {
+        int32_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{signed_integer, uint64_t(int64_t(n))};
+      } else if ((t == "uint64") || (t == "pointer") || (t == "cached_string") || (t == "node_handle")) {
+        uint64_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{(t == "cached_string") ? cached_string : ((t == "pointer") ? pointer : unsigned_integer), n};
+      } else if (t == "int64") {
+        int64_t n;
+        if (!integer(n))
+          return false;
+        v = value_t{signed_integer, uint64_t(n)};
+      } else if ((t == "string") || (t == "invalid") || (t == "binary")) {
+        v = value_t{(t == "binary") ? binary : ((t == "invalid") ? formatted : string)};
+        if (!sized(v.bytes))
+          return false;
+      } else if (t == "capnp") {
+        v = value_t{capnp};
+        if (!integer(v.number) || !sized(v.bytes))
+          return false;
+      } else
+        return false;
+      cb(field, v);
+    }
+    return true;
+  }
+
+  void format_text(std::string& out, const descriptor_t& d, std::span<const char> payload, const resolver_t* resolver, uint64_t frame) {
+    bool first = true;
+    bool good = visit_fields(d, payload, [&](const field_t& field, const value_t& v) {
+      if (!first)
+        out += ", ";
+      first = false;
+      out += field.name;
+      out += " = ";
+      switch (v.kind) {
+        using enum value_t::kind_e;
+      case boolean:
+        out += v.number ? "true" : "false";
+        break;
+      case signed_integer:
+        out += std::format("{}", int64_t(v.number));
+        break;
+      case unsigned_integer:
+        out += std::format("{}", v.number);
+        break;
+      case pointer:
+        out += std::format("{:#x}", v.number);
+        break;
+      case string:
+        out += std::format("'{}'", v.bytes);
+        break;
+      case formatted:
+        out += v.bytes;
+        break;
+      case binary:
+        out += "blob";
+        break;
+      case cached_string: {
+        auto s = resolver ? resolver->string(v.number) : std::nullopt;
+        out += s ? std::format("'{}'", *s) : std::format("#{:#x}", v.number);
+        break;
+      }
+      case source_location: {
+        auto s = resolver ? resolver->source_location(v.number) : std::nullopt;
+        out += s ? std::string(*s) : std::format("@{}", v.number);
+        break;
+      }
+      case cookie:
+        out += std::format("{:#x}", (frame && v.number) ? (frame - v.number) : v.number);
+        break;
+      case capnp:
+        out += std::format("capnp({:#x}, {} bytes)", v.number, v.bytes.size());
+        break;
+      }
+    });
+    if (!good)
+      out += first ? "<undecodable>" : ", <undecodable>";
+  }
+
+  void format_json(std::string& out, const descriptor_t& d, std::span<const char> payload, const resolver_t* resolver) {
+    bool first = true;
+    out += '{';
+    bool good = visit_fields(d, payload, [&](const field_t& field, const value_t& v) {
+      if (!first)
+        out += ',';
+      first = false;
+      append_escaped(out, field.name);
+      out += ':';
+      switch (v.kind) {
+        using enum value_t::kind_e;
+      case boolean:
+        out += v.number ? "true" : "false";
+        break;
+      case signed_integer:
+        out += std::format("{}", int64_t(v.number));
+        break;
+      case unsigned_integer:
+      case pointer:
+      case cookie:
+        out += std::format("{}", v.number);
+        break;
+      case string:
+      case formatted:
+        append_escaped(out, v.bytes);
+        break;
+      case binary:
+        out += '"';
+        append_hex(out, v.bytes);
+        out += '"';
+        break;
+      case cached_string:
+      case source_location: {
+        auto s = resolver ? ((v.kind == cached_string) ? resolver->string(v.number) : resolver->source_location(v.number)) : std::nullopt;
+        if (s)
+          append_escaped(out, *s);
+        else
+          out += std::format("{}", v.number);
+        break;
+      }
+      case capnp:
+        out += std::format("{{\"schema\":\"{:#x}\",\"data\":\"", v.number);
+        append_hex(out, v.bytes);
+        out += "\"}";
+        break;
+      }
+    });
+    out += '}';
+    if (!good)
+      out += ",\"undecodable\":true";
+  }
+
+  std::string format_time(uint64_t time) {
+    return std::format("{}", std::chrono::tai_clock::time_point(std::chrono::microseconds(time)));
+  }
+
+  namespace {
+    // Registrations are ordinary info frames; their descriptors are recognised by message name.
+    template <typename S, typename L>
+    void read_registration(const descriptor_t& d, std::span<const char> payload, S&& on_string, L&& on_location) {
+      if (d.message == "string_cache"sv) {
+        uint64_t index = 0;
+        std::string_view data;
+        visit_fields(d, payload, [&](const field_t& field, const value_t& v) {
+          if (field.name == "index"sv)
+            index = v.number;
+          else if (field.name == "data"sv)
+            data = v.bytes;
+        });
+        on_string(index, data);
+      } else if (d.message == "source_location"sv) {
+        uint32_t index = 0;
+        uint64_t line = 0;
+        std::string_view function_name, file_name;
+        visit_fields(d, payload, [&](const field_t& field, const value_t& v) {
+          if (field.name == "index"sv)
+            index = v.number;
+          else if (field.name == "function_name"sv)
+            function_name = v.bytes;
+          else if (field.name == "file_name"sv)
+            file_name = v.bytes;
+          else if (field.name == "line"sv)
+            line = v.number;
+        });
+        on_location(index, std::format("{}:{} ({})", file_name, line, function_name));
+      }
+    }
+
+    // Cookies are resolved against frame, the entry's offset where the file's layout is kept; the tap's stream does not.
+    std::string render_text(const entry_t& e, const descriptor_t* d, std::span<const char> payload, const resolver_t* resolver,
+                            uint64_t frame) {
+      if (!d)
+        return std::format("[{} {:#x}] ???? #{:#x}", format_time(e.time), e.offset, e.index);
+      auto out = std::format("[{} {:#x}] {} {}: ", format_time(e.time), e.offset, nie::levstr(d->level), d->message);
+      format_text(out, *d, payload, resolver, frame);
+      return out;
+    }
+    std::string render_json(const entry_t& e, const descriptor_t* d, std::span<const char> payload, const resolver_t* resolver) {
+      std::string out = std::format("{{\"time\":{},\"offset\":{},\"index\":{}", e.time, e.offset, e.index);
+      if (d) {
+        out += std::format(",\"level\":\"{}\",\"message\":", nie::levstr(d->level));
+        append_escaped(out, d->message);
+        out += ",\"fields\":";
+        format_json(out, *d, payload, resolver);
+      }
+      out += '}';
+      return out;
+    }
+  } // namespace
+
+  nie::errorable<std::unique_ptr<file_t>> file_t::open(const std::string& path) {
+#if defined(_WIN32)
+    return std::unexpected(std::make_error_code(std::errc::not_supported));
+#else
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    struct stat st;
+    if (fstat(fd, &st)) {
+      auto ec = std::error_code(errno, std::system_category());
+      close(fd);
+      return std::unexpected(ec);
+    }
+    if (size_t(st.st_size) < sizeof(nie::log_buffer_t)) {
+      close(fd);
+      return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    }
+    auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    std::unique_ptr<file_t> file(new file_t);
+    file->data_ = static_cast<const char*>(ptr);
+    file->size_ = st.st_size;
+    auto header = reinterpret_cast<const nie::log_buffer_t*>(ptr);
+    if (header->signature == nie::log_compressed_signature) {
+      // The log is inflated into an anonymous mapping of its original size, one block at a time as it is read.
+      auto compressed = reinterpret_cast<const nie::log_compressed_t*>(ptr);
+      if ((size_t(st.st_size) < sizeof(nie::log_compressed_t)) || (compressed->content_length < nie::log_data_start) ||
+          ((compressed->index_offset + (compressed->blocks * sizeof(nie::log_block_t))) > size_t(st.st_size)))
+        return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+      auto inflated = mmap(nullptr, compressed->content_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (inflated == MAP_FAILED)
+        return std::unexpected(std::error_code(errno, std::system_category()));
+      file->compressed_ = file->data_;
+      file->compressed_size_ = file->size_;
+      file->data_ = static_cast<const char*>(inflated);
+      file->size_ = compressed->content_length;
+      file->codec_ = compressed->codec;
+      auto index = reinterpret_cast<const nie::log_block_t*>(file->compressed_ + compressed->index_offset);
+      file->blocks_.assign(index, index + compressed->blocks);
+      file->inflated_ = std::make_unique<std::once_flag[]>(compressed->blocks);
+      memcpy(static_cast<char*>(inflated), compressed->header, sizeof(compressed->header));
+      header = reinterpret_cast<const nie::log_buffer_t*>(inflated);
+    }
+    if (header->signature != nie::log_signature)
+      return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    if ((header->version != nie::log_version) || (header->chunk_size != nie::log_chunk_size))
+      return std::unexpected(std::make_error_code(std::errc::not_supported));
+    file->end_ = std::min<size_t>(header->content_length.load(), file->size_);
+    file->clock_ = header->clock;
+    if (header->chunk_age)
+      file->chunk_age_ = header->clock.tai(header->clock.tick_base + header->chunk_age) - header->clock.tai_base + 1;
+    if (!file->compressed_)
+      madvise(ptr, file->size_, MADV_SEQUENTIAL);
+    return file;
+#endif
+  }
+
+  file_t::~file_t() {
+#if !defined(_WIN32)
+    if (data_)
+      munmap(const_cast<char*>(data_), size_);
+    if (compressed_)
+      munmap(const_cast<char*>(compressed_), compressed_size_);
+#endif
+  }
+
+  void file_t::inflate(size_t begin, size_t end) const {
+    if (blocks_.empty() || (end <= nie::log_data_start))
+      return;
+    begin = std::max(begin, nie::log_data_start) - nie::log_data_start;
+    end = std::min(end, size_) - nie::log_data_start;
+    for (size_t block = begin / nie::log_block_size; (block < blocks_.size()) && ((block * nie::log_block_size) < end); block++)
+      std::call_once(inflated_[block], [&] {
+        auto& b = blocks_[block];
+        size_t offset = nie::log_data_start + (block * nie::log_block_size);
+        std::span<char> out(const_cast<char*>(data_) + offset, std::min(nie::log_block_size, size_ - offset));
+        // A block that does not inflate stays zero, which walks read as the end of its chunks.
+        if (((b.offset + b.size) > compressed_size_) || !inflate_block(codec_, std::span<const char>(compressed_ + b.offset, b.size), out))
+          memset(out.data(), 0, out.size());
+      });
+  }
+
+  const nie::log_buffer_t& file_t::header() const {
+    return *reinterpret_cast<const nie::log_buffer_t*>(data_);
+  }
+
+  verify_t file_t::verify(size_t threads) const {
+    if (!threads)
+      threads = std::max(1U, std::thread::hardware_concurrency());
+    size_t chunks = this->chunks();
+    threads = std::clamp<size_t>(chunks, 1, threads);
+    std::vector<verify_t> parts(threads);
+    auto check = [&](size_t t) {
+      auto& part = parts[t];
+      for (size_t chunk = (t * chunks) / threads; chunk < (((t + 1) * chunks) / threads); chunk++) {
+        part.chunks++;
+        size_t begin = nie::log_data_start + (chunk * nie::log_chunk_size);
+        size_t at = begin + nie::log_chunk_size - nie::log_seal_size;
+        if ((begin + nie::log_chunk_size) > end_)
+          continue;
+        inflate(begin, begin + nie::log_chunk_size);
+        frame_header_t header;
+        nie::log_seal_t seal;
+        memcpy(&header, data_ + at, sizeof(header));
+        memcpy(&seal, data_ + at + sizeof(header), sizeof(seal));
+        if (!(header.size & nie::log_frame_committed) || (header.index != nie::log_seal_index))
+          continue;
+        part.sealed++;
+        if ((seal.length != (at - begin)) || (nie::log_crc32c(0, data_ + begin, at - begin) != seal.crc))
+          part.corrupt.push_back(begin);
+      }
+    };
+    {
+      std::vector<std::jthread> workers;
+      for (size_t t = 1; t < threads; t++)
+        workers.emplace_back(check, t);
+      check(0);
+    }
+    verify_t out;
+    for (auto& part : parts) {
+      out.chunks += part.chunks;
+      out.sealed += part.sealed;
+      out.corrupt.insert(out.corrupt.end(), part.corrupt.begin(), part.corrupt.end());
+    }
+    return out;
+  }
+
+  size_t file_t::chunks() const {
+    return (end_ > nie::log_data_start) ? ((end_ - nie::log_data_start + nie::log_chunk_size - 1) / nie::log_chunk_size) : 0;
+  }
+
+  void file_t::walk(size_t chunk, const nie::function_ref<void(size_t, uint64_t, uint32_t)>& f) const {
+    size_t begin = nie::log_data_start + (chunk * nie::log_chunk_size);
+    inflate(begin, std::min(begin + nie::log_chunk_size, end_));
+    walk_chunk(data_, begin, std::min(begin + nie::log_chunk_size, end_), [&](size_t pos, const frame_header_t& header) {
+      f(pos, header.time ? clock_.tai(header.time) : 0, header.index);
+    });
+  }
+
+  void file_t::add_descriptor(uint32_t index, uint64_t offset) {
+    if (descriptors_.contains(index))
+      return;
+    auto p = payload(entry_t{0, offset, index, nie::level_e::internal});
+    auto text = std::string_view(p.data(), p.size());
+    if (auto d = parse_descriptor(text.substr(0, text.find('\0')))) {
+      d->index = index;
+      descriptors_.emplace(index, std::move(*d));
+    }
+  }
+
+  void file_t::add_registration(const entry_t& e) {
+    if (auto d = descriptor(e.index))
+      read_registration(
+          *d,
+          payload(e),
+          [&](uint64_t index, std::string_view data) { strings_[index] = data; },
+          [&](uint32_t index, std::string text) { locations_[index] = std::move(text); });
+  }
+
+  void file_t::add_continuation(uint64_t offset) {
+    auto p = payload(entry_t{0, offset, nie::log_continuation_index, nie::level_e::internal});
+    uint64_t key;
+    if (p.size() < sizeof(key))
+      return;
+    memcpy(&key, p.data(), sizeof(key));
+    continuations_[key].push_back(offset);
+  }
+
+  std::span<const char> file_t::join(uint64_t offset, std::span<const char> head) const {
+    std::unique_lock lock(joined_mutex_);
+    auto it = joined_.find(offset);
+    if (it != joined_.end())
+      return it->second;
+    nie::log_continued_t continued{};
+    std::string out;
+    if (head.size() >= sizeof(continued)) {
+      memcpy(&continued, head.data(), sizeof(continued));
+      out.assign(head.data() + sizeof(continued), head.size() - sizeof(continued));
+    }
+    if (auto found = continuations_.find(continued.key); found != continuations_.end()) {
+      // The tail index finds them chunk by chunk from the end.
+      auto pieces = found->second;
+      std::sort(pieces.begin(), pieces.end());
+      for (auto pos : pieces) {
+        if (out.size() >= continued.length)
+          break;
+        auto piece = payload(entry_t{0, pos, nie::log_continuation_index, nie::level_e::internal});
+        out.append(piece.data() + sizeof(continued.key), piece.size() - sizeof(continued.key));
+      }
+    }
+    // A head whose continuations are not all there reads as an empty payload.
+    if (out.size() < continued.length)
+      out.clear();
+    else
+      out.resize(continued.length);
+    return joined_.emplace(offset, std::move(out)).first->second;
+  }
+
+  void file_t::sort_entries(std::vector<entry_t>& entries) const {
+    for (auto& e : entries)
+      if (auto d = descriptor(e.index))
+        e.level = d->level;
+    std::sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) {
+      return std::tie(a.time, a.level, a.index, a.offset) < std::tie(b.time, b.level, b.index, b.offset);
+    });
+  }
+
+  void file_t::build_index(size_t threads) {
+    if (!threads)
+      threads = std::max(1U, std::thread::hardware_concurrency());
+    size_t chunks = this->chunks();
+    threads = std::clamp<size_t>(chunks, 1, threads);
+    struct part_t {
+      std::vector<entry_t> entries;
+      std::vector<std::pair<uint32_t, uint64_t>> descriptors;
+      std::vector<uint64_t> continuations;
+    };
+    std::vector<part_t> parts(threads);
+    auto in_parallel = [&](auto&& f) {
+      std::vector<std::jthread> workers;
+      for (size_t t = 1; t < threads; t++)
+        workers.emplace_back(f, t);
+      f(0);
+    };
+
+    in_parallel([&](size_t t) {
+      auto& part = parts[t];
+      for (size_t chunk = (t * chunks) / threads; chunk < (((t + 1) * chunks) / threads); chunk++)
+        walk(chunk, [&](size_t pos, uint64_t time, uint32_t index) {
+          if (index == nie::log_continuation_index)
+            part.continuations.push_back(pos);
+          else if (time == 0)
+            part.descriptors.emplace_back(index, pos);
+          else
+            part.entries.push_back(entry_t{time, pos, index, nie::level_e::internal});
+        });
+    });
+
+    descriptors_.clear();
+    strings_.clear();
+    locations_.clear();
+    continuations_.clear();
+    joined_.clear();
+    for (auto& part : parts) {
+      for (auto& [index, pos] : part.descriptors)
+        add_descriptor(index, pos);
+      for (auto pos : part.continuations)
+        add_continuation(pos);
+    }
+
+    in_parallel([&](size_t t) { sort_entries(parts[t].entries); });
+
+    entries_.clear();
+    for (auto& part : parts) {
+      auto middle = entries_.size();
+      entries_.insert(entries_.end(), part.entries.begin(), part.entries.end());
+      std::inplace_merge(entries_.begin(), entries_.begin() + middle, entries_.end(), [](const entry_t& a, const entry_t& b) {
+        return std::tie(a.time, a.level, a.index, a.offset) < std::tie(b.time, b.level, b.index, b.offset);
+      });
+      part = {};
+    }
+
+    for (auto& e : entries_)
+      add_registration(e);
+  }
+
+  void file_t::build_tail_index(uint64_t seconds) {
+    descriptors_.clear();
+    strings_.clear();
+    locations_.clear();
+    continuations_.clear();
+    joined_.clear();
+    entries_.clear();
+    auto span = seconds * 1000000;
+    // Chunks are handed out in time order and, with a bounded chunk age, a chunk holds nothing newer than its first frame
+    // plus that age. Once a run of chunks is entirely older than the cutoff minus the age, nothing before it can reach the
+    // cutoff. Without a bound a quiet thread's chunk can hold recent frames however far back it lies, so all are read.
+    uint64_t age = chunk_age_;
+    std::vector<entry_t> scanned;
+    uint64_t last = 0;
+    size_t first = chunks();
+    for (size_t old = 0; (first > 0) && (!age || (old < 16));) {
+      uint64_t newest = 0;
+      walk(--first, [&](size_t pos, uint64_t time, uint32_t index) {
+        if (index == nie::log_continuation_index)
+          add_continuation(pos);
+        else if (time == 0)
+          add_descriptor(index, pos);
+        else {
+          newest = std::max(newest, time);
+          scanned.push_back(entry_t{time, pos, index, nie::level_e::internal});
+        }
+      });
+      last = std::max(last, newest);
+      if (newest)
+        old = ((newest + age) < (last - std::min(last, span))) ? (old + 1) : 0;
+    }
+    uint64_t cutoff = last - std::min(last, span);
+    for (auto& e : scanned)
+      add_registration(e);
+
+    // Descriptors and registrations live wherever a message was first used, usually near the front, so only the front is
+    // searched for the ones the tail refers to.
+    std::vector<entry_t> undescribed;
+    std::unordered_set<uint64_t> strings;
+    std::unordered_set<uint32_t> locations;
+    auto need = [&](const entry_t& e) {
+      auto d = descriptor(e.index);
+      if (!d) {
+        undescribed.push_back(e);
+        return;
+      }
+      visit_fields(*d, payload(e), [&](const field_t&, const value_t& v) {
+        if ((v.kind == value_t::kind_e::cached_string) && v.number && !strings_.contains(v.number))
+          strings.insert(v.number);
+        else if ((v.kind == value_t::kind_e::source_location) && !locations_.contains(uint32_t(v.number)))
+          locations.insert(uint32_t(v.number));
+      });
+    };
+    for (auto& e : scanned)
+      if (e.time >= cutoff)
+        need(e);
+    for (size_t chunk = 0; (chunk < first) && (!undescribed.empty() || !strings.empty() || !locations.empty()); chunk++) {
+      std::vector<entry_t> entries;
+      walk(chunk, [&](size_t pos, uint64_t time, uint32_t index) {
+        if (index == nie::log_continuation_index)
+          add_continuation(pos);
+        else if (time == 0)
+          add_descriptor(index, pos);
+        else
+          entries.push_back(entry_t{time, pos, index, nie::level_e::internal});
+      });
+      for (auto& e : entries)
+        add_registration(e);
+      std::erase_if(strings, [&](uint64_t s) { return strings_.contains(s); });
+      std::erase_if(locations, [&](uint32_t l) { return locations_.contains(l); });
+      auto pending = std::move(undescribed);
+      undescribed.clear();
+      for (auto& e : pending)
+        need(e);
+    }
+
+    std::erase_if(scanned, [&](const entry_t& e) { return e.time < cutoff; });
+    sort_entries(scanned);
+    entries_ = std::move(scanned);
+  }
+
+  std::span<const entry_t> file_t::between(uint64_t from, uint64_t to) const {
+    auto begin = std::lower_bound(entries_.begin(), entries_.end(), from, [](const entry_t& e, uint64_t t) { return e.time < t; });
+    auto end = std::lower_bound(begin, entries_.end(), to, [](const entry_t& e, uint64_t t) { return e.time < t; });
+    return std::span<const entry_t>(begin, end);
+  }
+
+  const descriptor_t* file_t::descriptor(uint32_t index) const {
+    auto it = descriptors_.find(index);
+    return (it != descriptors_.end()) ? &it->second : nullptr;
+  }
+
+  std::span<const char> file_t::payload(const entry_t& e) const {
+    frame_header_t header;
+    inflate(e.offset, e.offset + sizeof(header));
+    memcpy(&header, data_ + e.offset, sizeof(header));
+    inflate(e.offset, e.offset + (header.size & nie::log_frame_size_mask));
+    std::span<const char> data(data_ + e.offset + sizeof(header), (header.size & nie::log_frame_size_mask) - sizeof(header));
+    if (header.size & nie::log_frame_continued)
+      return join(e.offset, data);
+    return data;
+  }
+
+  std::string file_t::text(const entry_t& e) const {
+    return render_text(e, descriptor(e.index), payload(e), this, e.offset);
+  }
+  std::string file_t::json(const entry_t& e) const {
+    return render_json(e, descriptor(e.index), payload(e), this);
+  }
+
+  std::optional<std::string_view> file_t::string(uint64_t index) const {
+    if (!index)
+      return ""sv;
+    auto it = strings_.find(index);
+    if (it == strings_.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  std::optional<std::string_view> file_t::source_location(uint32_t index) const {
+    auto it = locations_.find(index);
+    if (it == locations_.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  nie::errorable<std::unique_ptr<tap_t>> tap_t::attach(const std::string& name) {
+#if defined(_WIN32)
+    return std::unexpected(std::make_error_code(std::errc::not_supported));
+#else
+    int fd = shm_open(name.data(), O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    struct stat st;
+    if (fstat(fd, &st) || (size_t(st.st_size) < sizeof(nie::log_tap_t))) {
+      auto ec = errno ? std::error_code(errno, std::system_category()) : std::make_error_code(std::errc::invalid_argument);
+      close(fd);
+      return std::unexpected(ec);
+    }
+    auto ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+      return std::unexpected(std::error_code(errno, std::system_category()));
+    std::unique_ptr<tap_t> tap(new tap_t);
+    tap->tap_ = static_cast<nie::log_tap_t*>(ptr);
+    tap->mapped_ = st.st_size;
+    auto ring = tap->tap_;
+    if ((ring->signature != nie::log_tap_signature) || ((sizeof(nie::log_tap_t) + ring->size) > tap->mapped_))
+      return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    uint64_t none = 0;
+    if (!ring->attached.compare_exchange_strong(none, uint64_t(getpid()))) {
+      tap->tap_ = nullptr;
+      munmap(ptr, tap->mapped_);
+      return std::unexpected(std::make_error_code(std::errc::device_or_resource_busy));
+    }
+    // Whatever a previous collector left behind is skipped. Producers may still be copying for it until the writer
+    // notices the change, so head is closed and the ring only cleared once the last of them is out.
+    auto head = ring->head.fetch_or(nie::log_tap_closed) & ~nie::log_tap_closed;
+    while (ring->writers.load())
+      std::this_thread::yield();
+    memset(ring->data(), 0, ring->size);
+    ring->tail.store(head, std::memory_order_release);
+    ring->head.fetch_and(~nie::log_tap_closed, std::memory_order_release);
+    return tap;
+#endif
+  }
+
+  tap_t::~tap_t() {
+#if !defined(_WIN32)
+    if (tap_) {
+      tap_->attached.store(0, std::memory_order_release);
+      munmap(tap_, mapped_);
+    }
+#endif
+  }
+
+  size_t tap_t::poll(const nie::function_ref<void(const entry_t&, std::span<const char>)>& cb) {
+    auto ring = tap_;
+    auto data = ring->data();
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    size_t frames = 0;
+    // Only a dropped head leaves continuations behind for good.
+    if (dropped_seen_ != dropped()) {
+      dropped_seen_ = dropped();
+      continued_.clear();
+    }
+    while (tail != ring->head.load(std::memory_order_acquire)) {
+      auto pos = tail & (ring->size - 1);
+      uint64_t size = ring->size - pos;
+      if (size >= sizeof(nie::log_frame_t)) {
+        auto frame = reinterpret_cast<nie::log_frame_t*>(data + pos);
+        auto flags = frame->size.load(std::memory_order_acquire);
+        // Reserved but not written yet.
+        if (!(flags & nie::log_frame_committed))
+          break;
+        size = flags & nie::log_frame_size_mask;
+        std::span<const char> payload(frame->data, size - sizeof(nie::log_frame_t));
+        uint32_t index = frame->index;
+        uint64_t time = frame->time;
+        if (index == nie::log_continuation_index) {
+          uint64_t key;
+          if (payload.size() >= sizeof(key)) {
+            memcpy(&key, payload.data(), sizeof(key));
+            continued_[key].append(payload.data() + sizeof(key), payload.size() - sizeof(key));
+          }
+        } else if (index != nie::log_padding_index) {
+          if (time == 0) {
+            if (!descriptors_.contains(index)) {
+              std::string text(payload.data(), payload.size());
+              text.resize(text.find('\0') == std::string::npos ? text.size() : text.find('\0'));
+              auto& [owned, d] = descriptors_[index];
+              owned = std::move(text);
+              if (auto parsed = parse_descriptor(owned)) {
+                d = std::move(*parsed);
+                d.index = index;
+              } else
+                descriptors_.erase(index);
+            }
+          } else {
+            std::string joined;
+            if (flags & nie::log_frame_continued) {
+              nie::log_continued_t continued{};
+              if (payload.size() >= sizeof(continued)) {
+                memcpy(&continued, payload.data(), sizeof(continued));
+                joined.assign(payload.data() + sizeof(continued), payload.size() - sizeof(continued));
+              }
+              if (auto it = continued_.find(continued.key); it != continued_.end()) {
+                joined += it->second;
+                continued_.erase(it);
+              }
+              payload = std::span<const char>(joined.data(), (joined.size() >= continued.length) ? continued.length : 0);
+            }
+            entry_t e{ring->clock.tai(time), tail, index, nie::level_e::internal};
+            auto d = descriptor(e.index);
+            if (d) {
+              e.level = d->level;
+              read_registration(
+                  *d,
+                  payload,
+                  [&](uint64_t index, std::string_view text) { strings_[index] = text; },
+                  [&](uint32_t index, std::string text) { locations_[index] = std::move(text); });
+            }
+            cb(e, payload);
+            frames++;
+          }
+        }
+      }
+      memset(data + pos, 0, size);
+      tail += size;
+      ring->tail.store(tail, std::memory_order_release);
+    }
+    return frames;
+  }
+
+  uint64_t tap_t::dropped() const {
+    return tap_->dropped.load(std::memory_order_relaxed);
+  }
+
+  const descriptor_t* tap_t::descriptor(uint32_t index) const {
+    auto it = descriptors_.find(index);
+    return (it == descriptors_.end()) ? nullptr : &it->second.second;
+  }
+
+  std::string tap_t::text(const entry_t& e, std::span<const char> payload) const {
+    return render_text(e, descriptor(e.index), payload, this, 0);
+  }
+  std::string tap_t::json(const entry_t& e, std::span<const char> payload) const {
+    return render_json(e, descriptor(e.index), payload, this);
+  }
+
+  std::optional<std::string_view> tap_t::string(uint64_t index) const {
+    if (!index)
+      return ""sv;
+    auto it = strings_.find(index);
+    if (it == strings_.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  std::optional<std::string_view> tap_t::source_location(uint32_t index) const {
+    auto it = locations_.find(index);
+    if (it == locations_.end())
+      return std::nullopt;
+    return it->second;
+  }
+} // namespace nie::log_reader
@@ -18,6 +18,8 @@ namespace nie {
   }
   [[noreturn]] void fatal(std::string_view expletive, nie::source_location location) {
     nie::logger<"nie">{}.error<"fatal">("expletive"_log = expletive, "location"_log = location);
+    nie::log_text_flush();
+    nie::log_sync();
 #ifdef NIELIB_FULL_X11
     std::cerr << std::format("FATAL ERROR: {} at {}", expletive, location) << std::endl;
     static std::atomic<bool> first = false;
@@ -1,11 +1,25 @@
-#include <forward_list>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include <memory>
 #include <mutex>
 #include <nie.hpp>
 #include <nie/log.hpp>
+#include <nie/log_format.hpp>
 #include <nie/startup.hpp>
 #include <nie/string_literal.hpp>
 #include <print>
-#include <shared_mutex>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 namespace nie {
   using namespace std::literals;
@@ -14,51 +28,445 @@ namespace nie {
     nie::logger<"nie", "string_literal"> log;
   } // namespace
 
-  struct dynamic_string_data final : string_data {
-    std::string t;
-    dynamic_string_data(std::string t) : t(std::move(t)) {}
-    std::string_view text() const override {
-      return t;
+#if defined(__AVX2__)
+  namespace {
+    void string_hash_stripes(string_hash_detail::lanes_t& lanes, const char* p, size_t stripes) {
+      using namespace string_hash_detail;
+      static_assert(sizeof(lanes_t) == sizeof(__m256i));
+      auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes.data()));
+      auto p1 = _mm256_set1_epi32(int(prime32_1));
+      auto p2 = _mm256_set1_epi32(int(prime32_2));
+      for (; stripes; stripes--, p += stripe) {
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), p2));
+        acc = _mm256_or_si256(_mm256_slli_epi32(acc, 13), _mm256_srli_epi32(acc, 19));
+        acc = _mm256_mullo_epi32(acc, p1);
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes.data()), acc);
     }
-  };
+  } // namespace
+#endif
+
+  uint64_t string_hash_vector(std::string_view text) {
+    using namespace string_hash_detail;
+    auto lanes = seed();
+#if defined(__AVX2__)
+    string_hash_stripes(lanes, text.data(), text.size() / stripe);
+#else
+    stripes(lanes, text.data(), text.size() / stripe);
+#endif
+    auto tail = text.size() % stripe;
+    return finish(lanes, text.data() + (text.size() - tail), tail, text.size());
+  }
+
+  namespace {
+    // Layout of the files save_strings writes: this header, then count records of a string_data followed by its text,
+    // each padded to 8 bytes. The version changes along with string_hash or string_data.
+    constexpr uint64_t string_snapshot_signature = 0x31504E5352545349ULL;
+    constexpr uint32_t string_snapshot_version = 1;
+    struct string_snapshot_t {
+      uint64_t signature;
+      uint32_t version;
+      // log_crc32c of the records.
+      uint32_t crc;
+      uint64_t count;
+      uint64_t size;
+    };
+    inline size_t string_record_size(size_t text_size) {
+      return (sizeof(string_data) + text_size + 7) & ~size_t(7);
+    }
+  } // namespace
 
-  struct cache_ptr_t {
-    std::shared_mutex cache_mutex;
-    std::forward_list<dynamic_string_data> dyn_cache_;
-    std::unordered_map<std::string_view, string_data const*> cache_{{""sv, nullptr}};
-  }; // namespace
+  // Literals, see string_init::record. The linker gathers the records of every literal a module uses into its
+  // nie_strlit section and defines these; weak since a module may have none.
+  extern "C" {
+  [[gnu::visibility("hidden"), gnu::weak]] extern string_data const* const __start_nie_strlit[];
+  [[gnu::visibility("hidden"), gnu::weak]] extern string_data const* const __stop_nie_strlit[];
+  }
+  namespace {
+    std::span<string_data const* const> module_literals() {
+      if (!__start_nie_strlit)
+        return {};
+      return std::span(__start_nie_strlit, __stop_nie_strlit);
+    }
+  } // namespace
 
-  [[gnu::visibility("default")]] inline cache_ptr_t& cache_ptr() {
-    static cache_ptr_t x;
+  // Interned strings, sharded by string_hash. Each shard is an open-addressing table that is only written under the shard's
+  // mutex and read without locks: a slot is filled once and never changes, and a table past half full is replaced by a
+  // copy twice its size. Replaced tables are kept, since lookups may still be probing them; together they are smaller
+  // than the live one.
+  struct intern_table_t {
+    struct slot_t {
+      std::atomic<size_t> hash = 0;
+      std::atomic<string_data const*> data = nullptr;
+    };
+    struct table_t {
+      size_t mask;
+      slot_t* slots;
+    };
+    // A module's literals sorted by hash, built once when the module is added and never written again.
+    struct literals_t {
+      string_data const* const* records;
+      std::vector<uint64_t> hashes;
+      std::vector<string_data const*> data;
+    };
+    struct alignas(64) shard_t {
+      std::mutex mtx;
+      std::atomic<table_t*> table = new table_t{initial_slots - 1, new slot_t[initial_slots]};
+      size_t size = 0;
+      // Strings interned at runtime are carved out of blocks that are never freed.
+      char* arena = nullptr;
+      size_t arena_left = 0;
+      // See string_stats_t.
+      size_t created = 0;
+      size_t bytes = 0;
+      size_t reserved = 0;
+      size_t restored = 0;
+    };
+    // Lookups from text, counted in a slot picked per thread so busy threads do not share a cache line.
+    struct alignas(64) lookups_t {
+      std::atomic<uint64_t> count = 0;
+    };
+    static constexpr size_t shard_count = 64;
+    static constexpr size_t initial_slots = 256;
+    static constexpr size_t arena_block = 65536;
+    // Batches are only hashed on several threads when each gets at least this many strings.
+    static constexpr size_t batch_per_thread = 16384;
+    static constexpr size_t max_modules = 16;
+    std::array<shard_t, shard_count> shards;
+    std::array<lookups_t, 16> lookups;
+    std::atomic<size_t> mapped = 0;
+    std::mutex modules_mtx;
+    std::array<std::atomic<literals_t const*>, max_modules> modules = {};
+    size_t module_count = 0;
+
+    string_data const* find_literal(size_t hash, std::string_view text) const {
+      for (auto& m : modules) {
+        auto literals = m.load(std::memory_order_acquire);
+        if (!literals)
+          break;
+        auto begin = literals->hashes.begin();
+        for (auto it = std::lower_bound(begin, literals->hashes.end(), hash); (it != literals->hashes.end()) && (*it == hash); ++it)
+          if (literals->data[it - begin]->text() == text)
+            return literals->data[it - begin];
+      }
+      return nullptr;
+    }
+    // Lock-free lookup of a string interned so far, literal or not.
+    string_data const* lookup(size_t hash, std::string_view text) {
+      if (auto literal = find_literal(hash, text))
+        return literal;
+      return find(shard(hash).table.load(std::memory_order_acquire), hash, text);
+    }
+    void add_module(std::span<string_data const* const> records);
+    inline void count_lookups(uint64_t n) {
+      thread_local size_t slot = std::hash<std::thread::id>{}(std::this_thread::get_id()) % lookups.size();
+      lookups[slot].count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline static size_t shard_index(size_t hash) {
+      return (hash >> 32) % shard_count;
+    }
+    inline shard_t& shard(size_t hash) {
+      return shards[shard_index(hash)];
+    }
+    static string_data const* find(const table_t* table, size_t hash, std::string_view text) {
+      for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        auto& slot = table->slots[i];
+        auto data = slot.data.load(std::memory_order_acquire);
+        if (!data)
+          return nullptr;
+        if ((slot.hash.load(std::memory_order_relaxed) == hash) && (data->text() == text))
+          return data;
+      }
+    }
+    static void place(table_t* table, size_t hash, string_data const* data) {
+      size_t i = hash & table->mask;
+      while (table->slots[i].data.load(std::memory_order_relaxed))
+        i = (i + 1) & table->mask;
+      table->slots[i].hash.store(hash, std::memory_order_relaxed);
+      table->slots[i].data.store(data, std::memory_order_release);
+    }
+    // Called with the shard locked.
+    static void add(shard_t& s, size_t hash, string_data const* data) {
+      auto table = s.table.load(std::memory_order_relaxed);
+      if (((s.size + 1) * 2) > (table->mask + 1)) {
+        auto grown = new table_t{(table->mask * 2) + 1, new slot_t[(table->mask + 1) * 2]};
+        for (size_t i = 0; i <= table->mask; i++)
+          if (auto d = table->slots[i].data.load(std::memory_order_relaxed))
+            place(grown, table->slots[i].hash.load(std::memory_order_relaxed), d);
+        s.table.store(grown, std::memory_order_release);
+        table = grown;
+      }
+      place(table, hash, data);
+      s.size++;
+    }
+    // Called with the shard locked.
+    static string_data const* insert(shard_t& s, size_t hash, std::string_view text) {
+      if (auto found = find(s.table.load(std::memory_order_relaxed), hash, text))
+        return found;
+      auto p = allocate(s, sizeof(string_data) + text.size());
+      memcpy(p + sizeof(string_data), text.data(), text.size());
+      auto data = new (p) string_data{hash, uint32_t(text.size())};
+      add(s, hash, data);
+      s.created++;
+      s.bytes += sizeof(string_data) + text.size();
+      return data;
+    }
+    static char* allocate(shard_t& s, size_t size) {
+      size = (size + 7) & ~size_t(7);
+      if (size > (arena_block / 4)) {
+        s.reserved += size;
+        return new char[size];
+      }
+      if (s.arena_left < size) {
+        s.reserved += arena_block;
+        s.arena = new char[arena_block];
+        s.arena_left = arena_block;
+      }
+      auto p = s.arena;
+      s.arena += size;
+      s.arena_left -= size;
+      return p;
+    }
+  };
+
+  // Every copy of this file adds its own module's literals to the table when its static initializers run. The first
+  // one also does so on first use, since other translation units may intern text during static initialization.
+  [[gnu::visibility("default")]] inline intern_table_t& intern_table() {
+    static intern_table_t x;
+    static const bool added = (x.add_module(module_literals()), true);
+    static_cast<void>(added);
     return x;
   }
+  namespace {
+    const bool module_added = (intern_table().add_module(module_literals()), true);
+  } // namespace
 
-  string::string(std::string_view text) {
-    {
-      std::shared_lock lock(cache_ptr().cache_mutex);
-      if (cache_ptr().cache_.contains(text)) {
-        data_ = cache_ptr().cache_.at(text);
+  void intern_table_t::add_module(std::span<string_data const* const> records) {
+    std::unique_lock lock(modules_mtx);
+    if (records.empty())
+      return;
+    for (size_t m = 0; m < module_count; m++)
+      if (modules[m].load(std::memory_order_relaxed)->records == records.data())
         return;
-      }
+    nie::require(module_count < max_modules);
+    std::vector<string_data const*> sorted(records.begin(), records.end());
+    std::ranges::sort(sorted, [](string_data const* a, string_data const* b) {
+      return (a->hash != b->hash) ? (a->hash < b->hash) : (a->text() < b->text());
+    });
+    auto literals = new literals_t{records.data()};
+    for (auto d : sorted) {
+      auto text = d->text();
+      auto orig = lookup(d->hash, text);
+      if (!orig && !literals->data.empty() && (literals->data.back()->text() == text))
+        orig = literals->data.back();
+      // Shared with a module added earlier through symbol interposition.
+      if (orig == d)
+        continue;
+      if (orig)
+        log.error<"register">("duplicate"_log = text, "me"_log = size_t(d), "orig"_log = size_t(orig));
+      nie::require(!orig);
+      literals->hashes.push_back(d->hash);
+      literals->data.push_back(d);
     }
-    std::unique_lock lock(cache_ptr().cache_mutex);
-    if (cache_ptr().cache_.contains(text)) {
-      data_ = cache_ptr().cache_.at(text);
+    if (literals->data.empty()) {
+      delete literals;
+      return;
+    }
+    modules[module_count++].store(literals, std::memory_order_release);
+  }
+
+  string::string(std::string_view text) {
+    if (text.empty())
       return;
+    auto& interned = intern_table();
+    nie::require(text.size() <= UINT32_MAX);
+    auto hash = string_hash(text);
+    interned.count_lookups(1);
+    data_ = interned.lookup(hash, text);
+    if (data_)
+      return;
+    auto& shard = interned.shard(hash);
+    std::unique_lock lock(shard.mtx);
+    data_ = intern_table_t::insert(shard, hash, text);
+  }
+
+  std::span<string> string::intern(std::span<const std::string_view> texts, std::span<string> out) {
+    nie::require(out.size() >= texts.size());
+    auto& interned = intern_table();
+    size_t n = texts.size();
+    std::vector<uint64_t> hashes(n);
+    auto lookup = [&](size_t begin, size_t end) {
+      size_t looked = 0;
+      for (size_t i = begin; i < end; i++) {
+        auto text = texts[i];
+        nie::require(text.size() <= UINT32_MAX);
+        if (text.empty()) {
+          out[i] = string();
+          continue;
+        }
+        hashes[i] = string_hash(text);
+        out[i] = string(interned.lookup(hashes[i], text));
+        looked++;
+      }
+      interned.count_lookups(looked);
+    };
+    size_t threads = std::clamp<size_t>(n / intern_table_t::batch_per_thread, 1, std::max(1U, std::thread::hardware_concurrency()));
+    {
+      std::vector<std::jthread> workers;
+      for (size_t t = 1; t < threads; t++)
+        workers.emplace_back(lookup, (t * n) / threads, ((t + 1) * n) / threads);
+      lookup(0, n / threads);
+    }
+
+    // The misses, grouped by shard so that each shard is locked once.
+    std::array<size_t, intern_table_t::shard_count + 1> starts = {};
+    for (size_t i = 0; i < n; i++)
+      if (!out[i].data_ && !texts[i].empty())
+        starts[intern_table_t::shard_index(hashes[i]) + 1]++;
+    for (size_t s = 0; s < intern_table_t::shard_count; s++)
+      starts[s + 1] += starts[s];
+    std::vector<size_t> misses(starts.back());
+    auto fill = starts;
+    for (size_t i = 0; i < n; i++)
+      if (!out[i].data_ && !texts[i].empty())
+        misses[fill[intern_table_t::shard_index(hashes[i])]++] = i;
+    for (size_t s = 0; s < intern_table_t::shard_count; s++) {
+      if (starts[s] == starts[s + 1])
+        continue;
+      auto& shard = interned.shards[s];
+      std::unique_lock lock(shard.mtx);
+      for (size_t m = starts[s]; m < starts[s + 1]; m++) {
+        auto i = misses[m];
+        out[i] = string(intern_table_t::insert(shard, hashes[i], texts[i]));
+      }
     }
-    cache_ptr().dyn_cache_.emplace_front(std::string(text));
-    data_ = &cache_ptr().dyn_cache_.front();
-    // log.trace<"register">("Registering (D) {:#X} as {}", std::bit_cast<std::size_t>(data_), data_->text());
-    cache_ptr().cache_.emplace(data_->text(), data_);
+    return out.first(n);
   }
 
+#if !defined(__clang__)
   [[gnu::visibility("default")]] void register_literal(string_data const* d) {
-    std::unique_lock lock(cache_ptr().cache_mutex);
-    if (cache_ptr().cache_.contains(d->text())) {
-      log.error<"register">("duplicate"_log = d->text(), "me"_log = size_t(d), "orig"_log = size_t(cache_ptr().cache_.at(d->text())));
+    auto& interned = intern_table();
+    auto text = d->text();
+    auto& shard = interned.shard(d->hash);
+    std::unique_lock lock(shard.mtx);
+    auto orig = interned.lookup(d->hash, text);
+    if (orig)
+      log.error<"register">("duplicate"_log = text, "me"_log = size_t(d), "orig"_log = size_t(orig));
+    nie::require(!orig);
+    intern_table_t::add(shard, d->hash, d);
+  }
+#endif
+
+  string_stats_t string_stats() {
+    auto& interned = intern_table();
+    string_stats_t out;
+    {
+      std::unique_lock lock(interned.modules_mtx);
+      for (size_t m = 0; m < interned.module_count; m++)
+        out.literals += interned.modules[m].load(std::memory_order_relaxed)->data.size();
+    }
+    for (auto& shard : interned.shards) {
+      std::unique_lock lock(shard.mtx);
+      out.entries += shard.size;
+      out.bytes += shard.bytes;
+      out.reserved += shard.reserved;
+      out.restored += shard.restored;
+      out.misses += shard.created;
+    }
+    for (auto& l : interned.lookups)
+      out.hits += l.count.load(std::memory_order_relaxed);
+    // Every miss is counted as a lookup first.
+    out.hits -= out.misses;
+    out.mapped = interned.mapped.load(std::memory_order_relaxed);
+    return out;
+  }
+
+  std::error_code save_strings(const std::string& path) {
+    auto& interned = intern_table();
+    std::string records;
+    uint64_t count = 0;
+    for (auto& shard : interned.shards) {
+      std::unique_lock lock(shard.mtx);
+      auto table = shard.table.load(std::memory_order_relaxed);
+      for (size_t i = 0; i <= table->mask; i++) {
+        auto d = table->slots[i].data.load(std::memory_order_relaxed);
+        if (!d)
+          continue;
+        string_data header = {d->hash, d->size};
+        auto at = records.size();
+        records.resize(at + string_record_size(d->size));
+        memcpy(records.data() + at, &header, sizeof(header));
+        memcpy(records.data() + at + sizeof(header), d->text().data(), d->size);
+        count++;
+      }
+    }
+    string_snapshot_t header = {
+        string_snapshot_signature, string_snapshot_version, log_crc32c(0, records.data(), records.size()), count, records.size()};
+    auto tmp = path + ".tmp";
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(records.data(), records.size());
+    file.close();
+    if (!file || std::rename(tmp.data(), path.data())) {
+      unlink(tmp.data());
+      return std::make_error_code(std::errc::io_error);
+    }
+    return {};
+  }
+
+  std::error_code restore_strings(const std::string& path) {
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return std::error_code(errno, std::system_category());
+    struct stat st;
+    if (fstat(fd, &st)) {
+      auto ec = std::error_code(errno, std::system_category());
+      close(fd);
+      return ec;
+    }
+    if (size_t(st.st_size) < sizeof(string_snapshot_t)) {
+      close(fd);
+      return std::make_error_code(std::errc::invalid_argument);
+    }
+    // Private and writable, since string_data::logged_generation is written in place.
+    auto ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+      return std::error_code(errno, std::system_category());
+    auto header = static_cast<const string_snapshot_t*>(ptr);
+    auto records = static_cast<char*>(ptr) + sizeof(string_snapshot_t);
+    if ((header->signature != string_snapshot_signature) || (header->version != string_snapshot_version) ||
+        (header->size != (size_t(st.st_size) - sizeof(string_snapshot_t))) || (log_crc32c(0, records, header->size) != header->crc)) {
+      munmap(ptr, st.st_size);
+      return std::make_error_code(std::errc::invalid_argument);
+    }
+    // Every record is checked to lie within the file before any of them is interned, so the mapping is either used or
+    // released as a whole.
+    size_t at = 0;
+    bool valid = true;
+    for (uint64_t i = 0; valid && (i < header->count); i++) {
+      valid = (header->size - at) >= sizeof(string_data);
+      auto record = valid ? string_record_size(reinterpret_cast<const string_data*>(records + at)->size) : 0;
+      valid = valid && (record <= (header->size - at));
+      at += record;
+    }
+    if (!valid || (at != header->size)) {
+      munmap(ptr, st.st_size);
+      return std::make_error_code(std::errc::invalid_argument);
+    }
+    auto& interned = intern_table();
+    interned.mapped.fetch_add(st.st_size, std::memory_order_relaxed);
+    for (at = 0; at < header->size;) {
+      auto d = reinterpret_cast<string_data*>(records + at);
+      at += string_record_size(d->size);
+      auto& shard = interned.shard(d->hash);
+      std::unique_lock lock(shard.mtx);
+      if (interned.lookup(d->hash, d->text()))
+        continue;
+      intern_table_t::add(shard, d->hash, d);
+      shard.restored++;
     }
-    nie::require(!cache_ptr().cache_.contains(d->text()));
-    // log.trace<"register">("Registering (S) {:#X} as {}", std::bit_cast<std::size_t>(d), d->text());
-    cache_ptr().cache_.emplace(d->text(), d);
+    return {};
   }
-} // namespace nie
\ No newline at end of file
+} // namespace nie
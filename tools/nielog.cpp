@@ -0,0 +1,206 @@
+#include <charconv>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <nie/log_reader.hpp>
+#include <thread>
+
+namespace {
+  using namespace std::literals;
+
+  void usage() {
+    std::cerr << "usage: nielog [--json] [--stats] [--threads N] [--level N] [--message PREFIX] [--from US] [--to US]"
+                 " [--tail SECONDS] [--columns DIR] FILE...\n"
+                 "       nielog --compress [--threads N] FILE...\n"
+                 "       nielog --verify [--threads N] FILE...\n"
+                 "       nielog --tap [--json] [--level N] [--message PREFIX] /nielog.NAME.PID"
+              << std::endl;
+  }
+
+  bool parse(std::string_view text, uint64_t& out) {
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return (ec == std::errc()) && (ptr == (text.data() + text.size()));
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  bool json = false;
+  bool stats = false;
+  uint64_t threads = 0;
+  uint64_t level = uint64_t(nie::level_e::internal);
+  uint64_t from = 0;
+  uint64_t to = uint64_t(-1);
+  uint64_t tail = 0;
+  bool tap = false;
+  bool compress = false;
+  bool verify = false;
+  std::string columns;
+  std::string_view message;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    auto value = [&](uint64_t& out) {
+      if (((i + 1) >= argc) || !parse(argv[++i], out)) {
+        usage();
+        exit(1);
+      }
+    };
+    if (arg == "--json"sv)
+      json = true;
+    else if (arg == "--compress"sv)
+      compress = true;
+    else if (arg == "--verify"sv)
+      verify = true;
+    else if (arg == "--tap"sv)
+      tap = true;
+    else if (arg == "--stats"sv)
+      stats = true;
+    else if (arg == "--threads"sv)
+      value(threads);
+    else if (arg == "--level"sv)
+      value(level);
+    else if (arg == "--from"sv)
+      value(from);
+    else if (arg == "--to"sv)
+      value(to);
+    else if (arg == "--tail"sv)
+      value(tail);
+    else if ((arg == "--columns"sv) && ((i + 1) < argc))
+      columns = argv[++i];
+    else if ((arg == "--message"sv) && ((i + 1) < argc))
+      message = argv[++i];
+    else if (arg.starts_with("--")) {
+      usage();
+      return 1;
+    } else
+      files.emplace_back(arg);
+  }
+  if (files.empty()) {
+    usage();
+    return 1;
+  }
+
+  if (compress) {
+    for (auto& name : files) {
+      auto size = nie::log_reader::compress_file(name, name + "z", nie::log_codec_e::bzip2, 9, threads);
+      if (!size) {
+        std::cerr << name << ": " << size.error().message() << std::endl;
+        return 1;
+      }
+      std::cerr << name << "z: " << *size << " bytes" << std::endl;
+    }
+    return 0;
+  }
+
+  if (verify) {
+    bool good = true;
+    for (auto& name : files) {
+      auto file = nie::log_reader::file_t::open(name);
+      if (!file) {
+        std::cerr << name << ": " << file.error().message() << std::endl;
+        return 1;
+      }
+      auto& header = (*file)->header();
+      std::string build_id;
+      for (size_t i = 0; i < header.build_id_size; i++)
+        build_id += std::format("{:02x}", header.build_id[i]);
+      auto result = (*file)->verify(threads);
+      std::cout << std::format("{}: version {} build id {} started {}\n",
+          name,
+          header.version,
+          build_id.empty() ? "unknown"sv : std::string_view(build_id),
+          nie::log_reader::format_time(header.start_time));
+      std::cout << std::format("{}: {} chunks, {} sealed, {} corrupt\n", name, result.chunks, result.sealed, result.corrupt.size());
+      for (auto offset : result.corrupt)
+        std::cout << std::format("{}: chunk at {:#x} does not match its checksum\n", name, offset);
+      good &= result.corrupt.empty();
+    }
+    std::cout.flush();
+    return good ? 0 : 1;
+  }
+
+  std::string out;
+  if (tap) {
+    if (files.size() != 1) {
+      usage();
+      return 1;
+    }
+    auto attached = nie::log_reader::tap_t::attach(files[0]);
+    if (!attached) {
+      std::cerr << files[0] << ": " << attached.error().message() << std::endl;
+      return 1;
+    }
+    auto& live = **attached;
+    uint64_t dropped = 0;
+    while (true) {
+      auto frames = live.poll([&](const nie::log_reader::entry_t& e, std::span<const char> payload) {
+        if (uint64_t(e.level) > level)
+          return;
+        auto d = live.descriptor(e.index);
+        if (!message.empty() && (!d || !d->message.starts_with(message)))
+          return;
+        out += json ? live.json(e, payload) : live.text(e, payload);
+        out += '\n';
+      });
+      if (live.dropped() != dropped) {
+        std::cerr << "dropped " << (live.dropped() - dropped) << " frames" << std::endl;
+        dropped = live.dropped();
+      }
+      std::cout << out;
+      std::cout.flush();
+      out.clear();
+      if (!frames)
+        std::this_thread::sleep_for(10ms);
+    }
+  }
+  for (auto& name : files) {
+    auto file = nie::log_reader::file_t::open(name);
+    if (!file) {
+      std::cerr << name << ": " << file.error().message() << std::endl;
+      return 1;
+    }
+    auto& log = **file;
+    if (tail)
+      log.build_tail_index(tail);
+    else
+      log.build_index(threads);
+    std::map<std::string_view, uint64_t> counts;
+    std::vector<nie::log_reader::entry_t> selected;
+    for (auto& e : log.between(from, to)) {
+      if (uint64_t(e.level) > level)
+        continue;
+      auto d = log.descriptor(e.index);
+      if (!message.empty() && (!d || !d->message.starts_with(message)))
+        continue;
+      if (stats) {
+        counts[d ? d->message : "?"sv]++;
+        continue;
+      }
+      if (!columns.empty()) {
+        selected.push_back(e);
+        continue;
+      }
+      out += json ? log.json(e) : log.text(e);
+      out += '\n';
+      if (out.size() >= 1048576) {
+        std::cout << out;
+        out.clear();
+      }
+    }
+    if (!columns.empty()) {
+      auto dir = (files.size() == 1) ? columns : (std::filesystem::path(columns) / std::filesystem::path(name).stem()).string();
+      auto rows = nie::log_reader::export_columns(log, selected, dir);
+      if (!rows) {
+        std::cerr << dir << ": " << rows.error().message() << std::endl;
+        return 1;
+      }
+      std::cerr << name << ": " << *rows << " rows" << std::endl;
+    }
+    for (auto& [m, n] : counts)
+      out += std::format("{} {}\n", n, m);
+    std::cout << out;
+    out.clear();
+  }
+  std::cout.flush();
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <barrier>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <nie/log.hpp>
+#include <nie/startup.hpp>
+#include <nie/tuneable.hpp>
+#include <thread>
+
+// Measures the calling side of nie::logger for a few typical argument mixes, with the message disabled, written to the
+// binary log only, and echoed as text as well. Results are written as a JSON array so runs can be compared.
+namespace {
+  using namespace std::literals;
+  using nie::level_e;
+
+  nie::logger<"bench"> bench;
+  nie::string cached;
+
+  // Warnings are always echoed as text; info messages only go to the binary log in release builds.
+  template <level_e level, nie::string_literal message, typename... T> inline void log_at(const T&... args) {
+    if constexpr (level == level_e::warn)
+      bench.warn<message>(args...);
+    else
+      bench.info<message>(args...);
+  }
+
+  template <level_e level> void ints(uint64_t i) {
+    log_at<level, "ints">("a"_log = i, "b"_log = int32_t(i), "c"_log = uint16_t(i));
+  }
+  template <level_e level> void strings(uint64_t i) {
+    log_at<level, "strings">("i"_log = i, "text"_log = "the quick brown fox jumps over the lazy dog"sv);
+  }
+  template <level_e level> void nie_strings(uint64_t i) {
+    log_at<level, "nie_strings">("i"_log = i, "name"_log = cached);
+  }
+  template <level_e level> void source_locations(uint64_t i) {
+    log_at<level, "source_locations">("i"_log = i, "at"_log = std::source_location::current());
+  }
+  template <level_e level> void fallback(uint64_t i) {
+    log_at<level, "fallback">("x"_log = double(i) * 0.5);
+  }
+
+  struct mix_t {
+    std::string_view name;
+    void (*binary)(uint64_t);
+    void (*text)(uint64_t);
+  };
+  constexpr mix_t mixes[] = {
+      {"ints", ints<level_e::info>, ints<level_e::warn>},
+      {"strings", strings<level_e::info>, strings<level_e::warn>},
+      {"nie_string", nie_strings<level_e::info>, nie_strings<level_e::warn>},
+      {"source_location", source_locations<level_e::info>, source_locations<level_e::warn>},
+      {"fallback", fallback<level_e::info>, fallback<level_e::warn>},
+  };
+
+  // Seconds for threads threads making calls calls each, from a common start until all are done.
+  double run(size_t threads, size_t calls, void (*f)(uint64_t), bool drain) {
+    std::barrier sync(threads + 1);
+    std::vector<std::jthread> workers;
+    for (size_t t = 0; t < threads; t++)
+      workers.emplace_back([&, t] {
+        sync.arrive_and_wait();
+        for (uint64_t i = 0; i < calls; i++)
+          f((t << 32) | i);
+        sync.arrive_and_wait();
+      });
+    sync.arrive_and_wait();
+    auto start = std::chrono::steady_clock::now();
+    sync.arrive_and_wait();
+    if (drain)
+      nie::log_text_flush();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  bool parse(std::string_view text, uint64_t& out) {
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return (ec == std::errc()) && (ptr == (text.data() + text.size()));
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  uint64_t max_threads = std::max(1U, std::thread::hardware_concurrency());
+  uint64_t iterations = 1000000;
+  std::string out = "nielog_bench.json";
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if ((arg == "--threads"sv) && ((i + 1) < argc) && parse(argv[i + 1], max_threads) && max_threads)
+      i++;
+    else if ((arg == "--iterations"sv) && ((i + 1) < argc) && parse(argv[i + 1], iterations) && iterations)
+      i++;
+    else if ((arg == "--out"sv) && ((i + 1) < argc))
+      out = argv[++i];
+    else {
+      std::cerr << "usage: nielog_bench [--threads N] [--iterations N] [--out FILE]" << std::endl;
+      return 1;
+    }
+  }
+
+  nie::run_startup();
+  nie::tuneable_control::set("log.segmented", "true");
+  nie::tuneable_control::set("log.segment_size", "268435456");
+  nie::tuneable_control::set("log.segment_keep", "2");
+  nie::init_log();
+  cached = nie::string("bench.cached_string"sv);
+
+  std::string json = "[";
+  for (size_t threads = 1;; threads = std::min<size_t>(threads * 2, max_threads)) {
+    for (auto& mix : mixes)
+      for (auto config : {"disabled"sv, "binary"sv, "text"sv}) {
+        // Every text call ends up on the console, so those runs are kept shorter.
+        size_t calls = (config == "text"sv) ? std::max<size_t>(iterations / 100, 1000) : iterations;
+        nie::set_log_enabled("bench", config != "disabled"sv);
+        auto seconds = run(threads, calls, (config == "text"sv) ? mix.text : mix.binary, config == "text"sv);
+        double total = double(threads * calls);
+        auto result = std::format("{{\"mix\":\"{}\",\"config\":\"{}\",\"threads\":{},\"calls\":{},\"seconds\":{:.6f},"
+                                  "\"ns_per_call\":{:.2f},\"frames_per_second\":{:.0f}}}",
+            mix.name,
+            config,
+            threads,
+            threads * calls,
+            seconds,
+            (seconds * 1e9 * threads) / total,
+            total / seconds);
+        json += (json.size() > 1) ? ",\n " : "\n ";
+        json += result;
+        std::cerr << result << std::endl;
+      }
+    if (threads == max_threads)
+      break;
+  }
+  json += "\n]\n";
+  nie::set_log_enabled("bench", true);
+  std::ofstream file(out, std::ios::trunc);
+  file << json;
+  file.close();
+  if (!file) {
+    std::cerr << out << ": write failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}
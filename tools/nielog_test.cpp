@@ -0,0 +1,173 @@
+#include <atomic>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <nie/log.hpp>
+#include <nie/log_reader.hpp>
+#include <nie/startup.hpp>
+#include <nie/string_literal.hpp>
+#include <nie/tuneable.hpp>
+#include <thread>
+#include <unistd.h>
+
+// Writes a sealed log from several threads and reads it back with the offline reader: split payloads, batches and
+// interned strings have to come out as they went in, and a flipped byte has to break its chunk's seal. Also interns the
+// same words on all threads at once. Exits non-zero on any mismatch.
+namespace {
+  using namespace std::literals;
+  using nie::level_e;
+  namespace reader = nie::log_reader;
+
+  nie::logger<"test"> test;
+  std::atomic<size_t> failures = 0;
+
+  void check(bool ok, std::string_view what) {
+    if (ok)
+      return;
+    std::cerr << "FAIL " << what << std::endl;
+    failures++;
+  }
+
+  constexpr size_t threads = 8;
+  constexpr size_t items = 20000;
+  constexpr size_t words = 2000;
+
+  std::string word(size_t i) {
+    return std::format("test.word.{}", i);
+  }
+
+  // Half the threads intern the words one by one and half as a batch; all must end up with the same strings.
+  void intern_test() {
+    std::vector<std::string> text;
+    for (size_t i = 0; i < words; i++)
+      text.push_back(word(i));
+    std::vector<std::string_view> views(text.begin(), text.end());
+    std::vector<std::vector<nie::string>> out(threads, std::vector<nie::string>(words));
+    {
+      std::vector<std::jthread> workers;
+      for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+          if (t % 2)
+            check(nie::string::intern(views, out[t]).size() == words, "intern fills the batch");
+          else
+            for (size_t i = 0; i < words; i++)
+              out[t][i] = nie::string(views[i]);
+        });
+    }
+    for (size_t t = 0; t < threads; t++)
+      for (size_t i = 0; i < words; i++)
+        check((out[t][i] == out[0][i]) && (out[t][i]() == views[i]), "interned on every thread as the same string");
+  }
+
+  struct item_t {
+    uint64_t id;
+    uint32_t thread;
+    nie::string word;
+  };
+
+  // Every thread logs its items as batches of fixed size events, in ranges of varying length.
+  void batch_test() {
+    std::vector<std::jthread> workers;
+    for (size_t t = 0; t < threads; t++)
+      workers.emplace_back([t] {
+        std::vector<item_t> mine;
+        for (size_t i = 0; i < items; i++)
+          mine.push_back(item_t{i, uint32_t(t), nie::string(word(i % words))});
+        for (size_t at = 0; at < items;) {
+          size_t n = std::min(items - at, 1 + ((at * 7) % 500));
+          auto logged = test.batch<level_e::info, "batch">(std::span(mine).subspan(at, n), [](const item_t& e) {
+            return std::tuple("id"_log = e.id, "thread"_log = e.thread, "word"_log = e.word);
+          });
+          check(logged == n, "every batched event logged");
+          at += n;
+        }
+      });
+  }
+
+  std::string executable_name() {
+    std::string name;
+    std::ifstream("/proc/self/comm") >> name;
+    return name;
+  }
+} // namespace
+
+int main() {
+  nie::run_startup();
+  nie::tuneable_control::set("log.checksum", "true");
+  nie::init_log();
+  auto path = executable_name() + ".nielog";
+
+  intern_test();
+  batch_test();
+  std::string big(200000, '\0');
+  for (size_t i = 0; i < big.size(); i++)
+    big[i] = char('a' + (i % 26));
+  test.info<"split">("text"_log = big);
+
+  auto opened = reader::file_t::open(path);
+  check(opened.has_value(), "log opens");
+  if (!opened)
+    return 1;
+  auto& log = **opened;
+  log.build_index();
+  std::vector<size_t> per_thread(threads);
+  size_t splits = 0;
+  uint64_t sample = 0;
+  for (auto& e : log.entries()) {
+    auto d = log.descriptor(e.index);
+    if (!d)
+      continue;
+    if (d->message == "test.split") {
+      auto joined = [&](const reader::field_t&, const reader::value_t& v) { splits += (v.bytes == big); };
+      check(reader::visit_fields(*d, log.payload(e), joined), "split payload decodes");
+    } else if (d->message == "test.batch") {
+      uint64_t id = 0, thread = threads;
+      std::optional<std::string_view> text;
+      check(reader::visit_fields(*d,
+                log.payload(e),
+                [&](const reader::field_t& f, const reader::value_t& v) {
+                  if (f.name == "id"sv)
+                    id = v.number;
+                  else if (f.name == "thread"sv)
+                    thread = v.number;
+                  else if (f.name == "word"sv)
+                    text = log.string(v.number);
+                }),
+          "batched event decodes");
+      check((thread < threads) && text && (*text == word(id % words)), "batched event reads back as written");
+      if (thread < threads)
+        per_thread[thread]++;
+      sample = e.offset;
+    }
+  }
+  check(splits == 1, "split payload joins to what was logged");
+  for (size_t t = 0; t < threads; t++)
+    check(per_thread[t] == items, "every batched event found");
+
+  auto verified = log.verify();
+  check(verified.sealed && verified.corrupt.empty(), "chunks are sealed and match their checksums");
+
+  // A flipped payload byte in a chunk a finished thread sealed has to show up in that chunk's checksum.
+  int fd = open(path.data(), O_RDWR | O_CLOEXEC);
+  check(sample && (fd != -1), "log reopens for writing");
+  if (sample && (fd != -1)) {
+    char byte;
+    auto at = off_t(sample + sizeof(nie::log_frame_t));
+    check(pread(fd, &byte, 1, at) == 1, "payload byte reads");
+    byte ^= 1;
+    check(pwrite(fd, &byte, 1, at) == 1, "payload byte flips");
+    check(reader::file_t::open(path).value()->verify().corrupt.size() == 1, "flipped byte breaks its chunk's seal");
+    byte ^= 1;
+    check(pwrite(fd, &byte, 1, at) == 1, "payload byte flips back");
+    close(fd);
+  }
+
+  if (failures) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::filesystem::remove(path);
+  std::cerr << "all checks passed" << std::endl;
+  return 0;
+}
@@ -50,6 +50,15 @@ tribute("expected", "CC0", "http://tl.tartanllama.xyz/")
 
 -- set_prefixname("")
 
+option("log_level")
+do
+  set_default("internal")
+  set_showmenu(true)
+  set_values("fatal", "error", "warn", "info", "debug", "trace", "internal")
+  set_description("Most verbose nie::logger level compiled in")
+end
+option_end()
+
 target("nielib")
 do
   set_kind("object")
@@ -67,6 +76,7 @@ do
   add_includedirs("include/", {public = true})
   add_headerfiles("include/(**)", {public = true})
   add_defines("NIELIB_FULL", {public = true})
+  add_defines("NIE_LOG_LEVEL=$(log_level)", {public = true})
   add_cxflags("-fasynchronous-unwind-tables", {public = true})
   add_ldflags("-fasynchronous-unwind-tables", {public = true})
 
@@ -163,3 +173,27 @@ do
   end, {public = true})
 end
 target_end()
+
+target("nielog")
+do
+  set_kind("binary")
+  add_deps("nielib")
+  add_files("tools/nielog.cpp")
+end
+target_end()
+
+target("nielog_bench")
+do
+  set_kind("binary")
+  add_deps("nielib")
+  add_files("tools/nielog_bench.cpp")
+end
+target_end()
+
+target("nielog_test")
+do
+  set_kind("binary")
+  add_deps("nielib")
+  add_files("tools/nielog_test.cpp")
+end
+target_end()